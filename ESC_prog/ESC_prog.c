@@ -10,8 +10,9 @@
  PORT configuration:
  
  * portB0-7 - display data (display_port) + programing input (MISO,MOSI,SCK)
+		(SERVO_HW_PWM: 2 - OC1B output PWM for ESC, 4-7 - display data DB4-DB7)
  * portD0 - SF output PWM for fan
-		1 - SW output PWM for ESC 50Hz, positive pulse 1-2ms
+		1 - SW output PWM for ESC (ESC_PROTOCOL: 50Hz/400Hz 1-2ms, OneShot125)
 		2 - SV impulse input - speed (interrupt 0)
 		3 - OFF signal - (interrupt 1)
 		4 
@@ -35,8 +36,162 @@
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
 #include <avr/eeprom.h>
+#include <avr/sleep.h>
+#include <util/crc16.h>
+
+//servo output mode
+//0 - SW pin is set / cleared in timer 1 compare interrupts
+//1 - pulse is generated by timer 1 on OC1B (PB2), display uses 4-bit bus (PB4-PB7)
+#ifndef SERVO_HW_PWM
+#define SERVO_HW_PWM 0
+#endif
+
+#if SERVO_HW_PWM
+#define DISPLAY_4BIT 1
+#endif
+
+//firmware variant (former separate sources), sets defaults of ESC_REGULATOR, THROTTLE_CURVE,
+//VOLTAGE_CALIBRATION and FAN_POLICY
+//0 - current regulator, medium throttle curve (ESC_prog.c)
+//1 - throttle directly to ESC, linear curve (ESC_prog_1.c, ESC_prog_simple.c)
+//2 - PI law of ESC_prog_2.c, progressive curve (ESC_prog_2.c)
+//3 - throttle directly to ESC, progressive curve (ESC_prog_simple1.2.c)
+#ifndef ESC_VARIANT
+#define ESC_VARIANT 0
+#endif
+
+//output for ESC
+//0 - wantedSpeed from throttle curve (no regulation)
+//1 - PII current regulator (regulator.h)
+//2 - PI law of ESC_prog_2.c (gains per 20ms frame)
+#ifndef ESC_REGULATOR
+#if ESC_VARIANT == 1 || ESC_VARIANT == 3
+#define ESC_REGULATOR 0
+#elif ESC_VARIANT == 2
+#define ESC_REGULATOR 2
+#else
+#define ESC_REGULATOR 1
+#endif
+#endif
+
+#ifndef THROTTLE_CURVE
+#if ESC_VARIANT == 1
+#define THROTTLE_CURVE 0	//THROTTLE_LINEAR
+#elif ESC_VARIANT == 2 || ESC_VARIANT == 3
+#define THROTTLE_CURVE 2	//THROTTLE_PROGRESSIVE
+#endif
+#endif
+
+//battery voltage calibration
+//0 - 10V + 1/25V, 0 % at 13.2V (ESC_prog.c, ESC_prog_simple1.2.c)
+//1 - 13V + 1/45V from ADC 40, 0 % at 14V (ESC_prog_1.c, ESC_prog_2.c, ESC_prog_simple.c)
+#ifndef VOLTAGE_CALIBRATION
+#if ESC_VARIANT == 1 || ESC_VARIANT == 2
+#define VOLTAGE_CALIBRATION 1
+#else
+#define VOLTAGE_CALIBRATION 0
+#endif
+#endif
+
+//fan and voltage measurement
+//0 - fan on while throttle is open, voltage measured every frame (ESC_prog.c)
+//1 - fan on above 2A, voltage measured only below 2A (ESC_prog_1.c, ESC_prog_2.c, ESC_prog_simple.c)
+//2 - fan is never switched on, voltage measured every frame (ESC_prog_simple1.2.c)
+#ifndef FAN_POLICY
+#if ESC_VARIANT == 1 || ESC_VARIANT == 2
+#define FAN_POLICY 1
+#elif ESC_VARIANT == 3
+#define FAN_POLICY 2
+#else
+#define FAN_POLICY 0
+#endif
+#endif
+
+//eeprom of old sources ESC_prog_1.c, ESC_prog_2.c, ESC_prog_simple.c - totalDistance at 10,
+//total capacity at 20 in 256/922 mAh (consumedCapacity>>8), LineMode at 30 as decimal digits
+//1 - on cold boot with empty 15-36, old values are converted and written to 15-36 (once)
+#ifndef EEPROM_MIGRATE
+#if ESC_VARIANT == 1 || ESC_VARIANT == 2
+#define EEPROM_MIGRATE 1
+#else
+#define EEPROM_MIGRATE 0
+#endif
+#endif
+
+//regulator gains
+//0 - defaults of regulator.h
+//1 - regulator_gains.h generated by sim/gain_tuner
+#ifndef REGULATOR_GAINS
+#define REGULATOR_GAINS 0
+#endif
+
+//idle sleep
+//1 - main loop sleeps in idle mode when no task is due (woken by any interrupt)
+//savings of IDLE_SLEEP and ADC_NOISE_REDUCTION are not measured - compare supply current of
+//the board (servo output connected, display on) and CPU duty (ISR_STATS pages) with 0 / 1
+#ifndef IDLE_SLEEP
+#define IDLE_SLEEP 1
+#endif
+
+//parking mode - seconds without throttle and wheel movement, then display is switched off,
+//servo output is stopped and CPU is in power-down until wheel (INT0) or OFF signal (INT1),
+//0 - disabled
+#ifndef PARKING_TIMEOUT
+#define PARKING_TIMEOUT 300
+#endif
+
+//interrupt statistics (debug build)
+//1 - execution time and latency of interrupts and late / missed frames are measured by timer 1,
+//    hidden display mode: hold button 1 for 3s, button 1 = next page, button 2 = clear
+#ifndef ISR_STATS
+#define ISR_STATS 0
+#endif
+
+//ESC output protocol
+#define ESC_SERVO50 0			//50Hz, impulse 1-2ms
+#define ESC_PWM400 1			//400Hz, impulse 1-2ms
+#define ESC_ONESHOT125 2		//2kHz, impulse 125-250us
+
+#ifndef ESC_PROTOCOL
+#define ESC_PROTOCOL ESC_SERVO50
+#endif
+
+//servo impulse: period and minimal impulse (wantedSpeed = 0) in timer 1 ticks,
+//max = SERVO_MIN + 1023, regulator runs every frame, other 20ms tasks every FRAMES_PER_20MS,
+//CURRENT_OVERSAMPLING_SHIFT - log2 of current samples per frame (one sample every 208us)
+#if ESC_PROTOCOL == ESC_ONESHOT125
+#define SERVO_CLK 1				//prescaler = 1 (8 ticks = 1us)
+#define SERVO_TICKS_US 8
+#define SERVO_PERIOD 4000		//period 500us
+#define SERVO_MIN 1000			//impulse 125-253us
+#define FRAMES_PER_20MS 40
+#define CURRENT_OVERSAMPLING_SHIFT 1
+#elif ESC_PROTOCOL == ESC_PWM400
+#define SERVO_CLK 2				//prescaler = 8 (1 tick = 1us)
+#define SERVO_TICKS_US 1
+#define SERVO_PERIOD 2500		//period 2.5ms
+#define SERVO_MIN 1024			//impulse 1.024-2.047ms
+#define FRAMES_PER_20MS 8
+#define CURRENT_OVERSAMPLING_SHIFT 3
+#else
+#define SERVO_CLK 2				//prescaler = 8 (1 tick = 1us)
+#define SERVO_TICKS_US 1
+#define SERVO_PERIOD 20000		//period 20ms
+#define SERVO_MIN 1024			//impulse 1.024-2.047ms
+#define FRAMES_PER_20MS 1
+#define CURRENT_OVERSAMPLING_SHIFT 4
+#endif
+
 #include "bitops.h"
 #include "display.h"
+#include "conversion.h"
+#if ESC_REGULATOR == 1
+#if REGULATOR_GAINS
+#include "regulator_gains.h"
+#endif
+#define REG_FRAMES FRAMES_PER_20MS	//regulator runs every frame, gains per 20ms
+#include "regulator.h"
+#endif
 
 //define ports
 /*----------------------------------------------*/
@@ -54,40 +209,133 @@
 #define SU 4
 #define SA 5
 
+//ADC acquisition mode
+//0 - conversions run continuously from ADC_vect
+//1 - every conversion is done in ADC Noise Reduction sleep from main loop,
+//    only when no servo edge or display transfer can be during it
+#ifndef ADC_NOISE_REDUCTION
+#define ADC_NOISE_REDUCTION 0
+#endif
+
+#define ADC_SLEEP_TICKS1 (104 * SERVO_TICKS_US)	//one conversion = 13 ADC clk = 104us of timer 1
+#define ADC_SLEEP_MARGIN1 (240 * SERVO_TICKS_US)	//no conversion closer than 240us before compare match
+
+//conversions in sleep fit only into the gap after 1-2ms impulse of 20ms period
+//(400Hz - about one current sample per frame, OneShot125 - no gap at full throttle)
+#if ADC_NOISE_REDUCTION && FRAMES_PER_20MS > 1
+#error "ADC_NOISE_REDUCTION needs ESC_PROTOCOL ESC_SERVO50"
+#endif
+
+//actualVoltage: lower limit of ADC range, value of empty battery (0 %) and conversion to 1/10V
+#if VOLTAGE_CALIBRATION == 1
+#define VOLTAGE_ADC_MIN 40
+#define VOLTAGE_EMPTY 40
+#define VOLTAGE_TENTHS(voltage) (130 + (((voltage)*(unsigned int)57)>>8))	//13V + 1/45V, 57/256 = 10/45 -> 1/10V
+#else
+#define VOLTAGE_ADC_MIN 0
+#define VOLTAGE_EMPTY 80
+#define VOLTAGE_TENTHS(voltage) (100 + (((voltage)*(unsigned int)205)>>9))	//10V + 1/25V, 205/512 = 2/5 -> 1/10V
+#endif
+
 
 /*----------------------------------
 Global variables definition
 -----------------------------------*/
 
-//sums for PII regulator
-unsigned int sum1 = 0;
-unsigned int sum2 = 0;
-
 //measured values
-unsigned char wantedSpeed = 0;			//output for the engine controller 0-255
+unsigned int wantedSpeed = 0;			//output for the engine controller 0-1023
 
 unsigned char wantedCurrent = 0;	//wanted input 0-255
 unsigned char actualCurrent = 0;		//0-50A 0-255
 unsigned char actualVoltage = 0;		//12.8-16.8V 80-180
 
-unsigned char current0 = 0;
+#if ESC_REGULATOR == 2
+//sums for PI regulator of ESC_prog_2.c
+unsigned char regSum1 = 0;
+unsigned int regSum2 = 0;
+#endif
+
+#define WHEEL_CIRCUMFERENCE 377			//travel distance of one wheel cycle (mm), must be < 1000
+
+//wheel speed from timer 1 timestamps of INT0 edges
+#define SPEED_CONSTANT (36000UL * WHEEL_CIRCUMFERENCE * SERVO_TICKS_US)	//speed (1/10 km/h) * period (ticks)
+#define SPEED_MAX 999					//99.9 km/h
+#define SPEED_TIMEOUT 150				//no edge for 3s (x20ms) -> speed 0 (0.45 km/h)
+#define SPEED_MIN_PERIOD (SPEED_CONSTANT / 800)	//shorter period (over 80 km/h) is contact bounce
+#define SPEED_AVERAGING 4				//averaged cycle periods, power of 2
 
-unsigned char CycleTime = 0;			//time of actual cycle			x2 ms
-unsigned char lastCyclePeriod = 0;		//last measured cycle period	x2 ms
-unsigned char actualSpeed = 0;			//last speed info				1/4 km/h
+volatile unsigned long servoTime = 0;	//timer 1 ticks at start of actual frame (TCNT1 extension)
+unsigned long lastCycleTime = 0;		//timestamp of last accepted wheel edge	ticks
+unsigned long cyclePeriods[SPEED_AVERAGING];	//ring of last cycle periods	ticks
+unsigned char cyclePeriodIndex = 0;		//oldest period in ring
+volatile unsigned long cyclePeriodSum = 0;	//sum of valid periods in ring	ticks
+volatile unsigned char cyclePeriodCount = 0;	//valid periods in ring, 0 = stopped
+volatile unsigned char speedTimeout = 0;	//x20ms to stop, 0 = stopped
 
-unsigned long distance=0;				//travel distance 			cycles 
-unsigned long totalDistance = 0;		//total travel distance    (saving to eeprom)
+unsigned char distanceMeters[DISPLAY_NUMBER_DIGITS];		//travel distance			m, decimal digits
+unsigned int distanceFraction = 0;							//travel distance under 1 m	mm
+unsigned long totalDistance = 0;							//total travel distance    (saving to eeprom) cycles
+unsigned char totalDistanceMeters[DISPLAY_NUMBER_DIGITS];	//total travel distance		m, decimal digits
+unsigned int totalDistanceFraction = 0;						//total distance under 1 m	mm
 
-unsigned long consumedCapacity=0;		//consumed						256 mAs
+#define CAPACITY_UNIT 922UL	//consumedCapacityFraction of 1 mAh (current 0-255 +1 every 20ms)
+
+unsigned int consumedCapacityFraction = 0;	//consumed under 1 mAh		1/922 mAh (saving to eeprom)
+unsigned int capacitySampleSum = 0;		//sum of current (0-255) of every conversion in actual 20ms
+unsigned char capacitySampleCount = 0;	//conversions in capacitySampleSum
+unsigned long consumedCapacity=0;		//consumed						mAh
 unsigned long totalConsumedCapacity = 0; //total consumed capacity      (saving to eeprom) in mAh
+unsigned int totalConsumedAh = 0;		//total consumed capacity		Ah
+unsigned int totalConsumedAhFraction = 0; //total consumed under 1 Ah	mAh
+
+//session state for warm boot - kept in RAM over watchdog, brown-out and external reset
+//(.noinit is not cleared by startup code), two copies with CRC, saved alternately every 20ms
+struct session
+{
+	unsigned char sequence;		//higher (mod 256) is newer copy
+	unsigned char distanceMeters[DISPLAY_NUMBER_DIGITS];
+	unsigned int distanceFraction;
+	unsigned long totalDistance;
+	unsigned long consumedCapacity;
+	unsigned int consumedCapacityFraction;
+	unsigned long totalConsumedCapacity;
+	unsigned char lineMode;
+#if ESC_REGULATOR == 1
+	int16_t regIntegral;
+	int16_t regErrorSum;
+	unsigned int regOutput;
+	unsigned char regCurrent0;
+	unsigned char regActive;
+#elif ESC_REGULATOR == 2
+	unsigned char regSum1;
+	unsigned int regSum2;
+#endif
+	unsigned int crc;			//CRC-CCITT of previous members
+};
+
+struct session sessions[2] __attribute__((section(".noinit")));
+unsigned char sessionIndex = 0;			//copy written by next save
+unsigned char sessionSequence = 0;		//sequence of next save
+
+//multibyte values for main loop, published by frame interrupt every 20ms
+//(interrupts change them at any time, reading by main loop would not be atomic)
+struct snapshot
+{
+	unsigned char distanceMeters[DISPLAY_NUMBER_DIGITS];
+	unsigned char totalDistanceMeters[DISPLAY_NUMBER_DIGITS];
+	unsigned long consumedCapacity;
+	unsigned int totalConsumedAh;
+};
+
+volatile struct snapshot snapshots[2];			//double buffer, valid is snapshots[snapshotSequence & 1]
+volatile unsigned char snapshotSequence = 0;	//incremented by every publish
 
 /*---------------------------
 display line mode 
-1 total distance (cycles)
+1 total distance (km)
 2 total consumed capacity (mAh)
-3 distance (cycles)
-4 consumed capacity (256 = 1 mAh)
+3 distance (m)
+4 consumed capacity (mAh)
 5 rest capacity (%)
 6 voltage
 7 current (255 = 50 A)
@@ -96,200 +344,491 @@ display line mode
 
 unsigned char LineMode; //mode of 1st and 2nd line on display (4b/4b)
 
-unsigned char displayPaused = 0;		// 1 -> display is paused
-unsigned char displayPausedCounter = 0; // decrement every 20ms -> 50 = 1s, if is 0 -> display is unpaused
+volatile unsigned char frameCounter = 0;	// increment every 20ms (scheduler tick)
+unsigned char frameDivider = 0;				// frames to next 20ms
 
 unsigned char lastButtonState = 0;		//pressed buttons
 
+//analog inputs measured in background by ADC_vect, in this order (current every 2nd conversion)
+#define ADC_INPUTS 4
+const unsigned char adcInputs[ADC_INPUTS] = {SI, SA, SI, SU};
+unsigned char adcIndex = 0;				//actually measured input (index to adcInputs)
+volatile unsigned char adcResult[8];	//last result of every input (8b - read is atomic)
 
-//conversion tables:
-//const unsigned char tabA[194] PROGMEM = {0,0,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,2,2,2,2,2,2,2,2,2,3,3,3,3,3,3,4,4,4,4,5,5,5,5,6,6,6,6,7,7,7,8,8,9,9,9,10,10,11,11,12,12,13,13,14,14,15,16,16,17,17,18,19,20,20,21,22,23,24,24,25,26,27,28,29,30,31,32,33,34,35,36,38,39,40,41,43,44,45,47,48,49,51,52,54,55,57,58,60,62,63,65,67,69,71,72,74,76,78,80,82,84,86,89,91,93,95,97,100,102,104,107,109,112,114,117,119,122,125,127,130,133,136,139,141,144,147,150,153,156,160,163,166,169,172,176,179,182,186,189,192,196,199,203,206,210,214,217,221,225,228,232,236,240,244,248,252,255};
-const unsigned char tabA[194] PROGMEM = {0,1,1,1,1,1,2,2,2,2,3,3,3,4,4,4,5,5,6,6,7,7,8,8,9,9,10,11,11,12,12,13,14,15,15,16,17,18,18,19,20,21,22,23,24,24,25,26,27,28,29,30,31,32,33,34,36,37,38,39,40,41,42,44,45,46,47,48,50,51,52,53,55,56,57,59,60,61,63,64,65,67,68,70,71,72,74,75,77,78,80,81,83,84,86,87,89,90,92,93,95,96,98,99,101,103,104,106,107,109,111,112,114,115,117,119,120,122,124,125,127,128,130,132,133,135,137,138,140,142,143,145,147,149,150,152,154,155,157,159,160,162,164,165,167,169,171,172,174,176,177,179,181,183,184,186,188,190,191,193,195,197,198,200,202,204,205,207,209,211,213,214,216,218,220,222,223,225,227,229,231,233,234,236,238,240,242,244,246,248,250,252,254,255};
-const unsigned char tabI[109] PROGMEM = {0,3,5,8,10,12,15,17,19,22,24,26,29,31,34,36,38,41,43,45,48,50,52,55,57,59,62,64,67,69,71,74,76,78,81,83,85,88,90,93,95,97,100,102,104,107,109,111,114,116,118,121,123,126,128,130,133,135,137,140,142,144,147,149,152,154,156,159,161,163,166,168,170,173,175,177,180,182,185,187,189,192,194,196,199,201,203,206,208,211,213,215,218,220,222,225,227,229,232,234,236,239,241,244,246,248,251,253,255};
-//const unsigned char tabU[147] PROGMEM = {0,2,4,6,7,9,11,13,14,16,18,20,21,23,25,27,28,30,32,34,35,37,39,41,42,44,46,47,49,51,53,54,56,58,60,61,63,65,67,68,70,72,74,75,77,79,81,82,84,86,87,89,91,93,94,96,98,100,101,103,105,107,108,110,112,114,115,117,119,121,122,124,126,128,129,131,133,134,136,138,140,141,143,145,147,148,150,152,154,155,157,159,161,162,164,166,168,169,171,173,174,176,178,180,181,183,185,187,188,190,192,194,195,197,199,201,202,204,206,208,209,211,213,215,216,218,220,221,223,225,227,228,230,232,234,235,237,239,241,242,244,246,248,249,251,253,255};
+//oversampled current: 16 x 10b samples -> 12b, every 3.3ms (less samples in faster protocols)
+#define CURRENT_OVERSAMPLING (1 << CURRENT_OVERSAMPLING_SHIFT)
+unsigned int currentSum = 0;			//sum of 10b samples
+unsigned char currentSumCount = 0;		//count of samples in currentSum
+volatile unsigned int currentSample[2];	//12b current, double buffer (16b read is not atomic)
+volatile unsigned char currentSampleIndex = 0;	//valid buffer
+
+volatile unsigned char adcDone = 0;		//1 -> conversion in sleep is complete
+
+//main loop tasks, run to completion in this order when frameCounter reaches next,
+//period max. 127 ticks, budget - expected max. run time (longer run is overrun)
+#define TASK_BUTTONS 0			//checkButton()
+#define TASK_DISPLAY 1			//displayRedraw() - compose display buffer
+#define TASK_FLUSH 2			//displayFlush() - changed characters to display queue
+#define TASK_EEPROM 3			//save of changed settings
+#define TASK_PARKING 4			//parking timeout
+#define TASK_SESSION 5			//sessionSave()
+#define TASKS 6
+
+struct task
+{
+	unsigned char period;		//x20ms
+	unsigned char next;			//frameCounter of next run
+	unsigned int budget;		//timer 1 ticks
+	unsigned int overruns;		//runs longer than budget
+};
+
+struct task tasks[TASKS] = {
+	{1, 0, 200 * SERVO_TICKS_US, 0},	//buttons every 20ms (debounce)
+	{25, 0, 1000 * SERVO_TICKS_US, 0},	//display every 0.5s
+	{1, 0, 300 * SERVO_TICKS_US, 0},	//flush every 20ms
+	{125, 0, 500 * SERVO_TICKS_US, 0},	//eeprom every 2.5s
+	{50, 0, 100 * SERVO_TICKS_US, 0},	//parking every 1s
+	{1, 0, 300 * SERVO_TICKS_US, 0},	//session every 20ms
+};
+
+#if PARKING_TIMEOUT
+unsigned int parkingSeconds = 0;		//s without throttle and wheel movement
+#endif
+
+#if ISR_STATS
+//statistics of interrupts in timer 1 ticks, time is measured from first to last statement
+//(without saving of registers), latency from timer event to first statement
+#define STAT_FRAME 0			//SERVO_FRAME_vect
+#define STAT_COMPB 1			//TIMER1_COMPB_vect
+#define STAT_ADC 2				//ADC_vect
+#define STAT_INT0 3				//INT0_vect
+#define STAT_DISPLAY 4			//TIMER0_OVF_vect
+#define STAT_VECTORS 5
+#define STAT_PAGES (STAT_VECTORS + 3)	//page per vector + frames + task overruns + boot time
+#define STAT_BOOT_TICK 16				//us, timer 2 prescaler 128
+#define STAT_LATE (50 * SERVO_TICKS_US)	//frame interrupt later than 50us is late
+#define STAT_HOLD 150					//x20ms button 1 held -> statistics are shown
+
+const char statNames[STAT_VECTORS][4] = {"Frm", "CmB", "ADC", "IN0", "Dsp"};
+volatile unsigned int statMax[STAT_VECTORS];		//max execution time			ticks
+volatile unsigned long statAverage[STAT_VECTORS];	//average execution time x8 (1/8 of new time), 32b - time up to max. period	ticks
+volatile unsigned int statLatency[STAT_VECTORS];	//max latency (frame and compare B)	ticks
+volatile unsigned int statLate = 0;					//frames with late frame interrupt
+volatile unsigned int statMissed = 0;				//frames without regulator run (compare B)
+volatile unsigned char statFrameDone = 1;			//1 -> compare B of actual frame is done
+unsigned char statPage = 0;							//shown page 1-STAT_PAGES, 0 = normal display
+unsigned char statHold = 0;							//x20ms button 1 held
+unsigned int statBoot = 0;							//main() to start of timer 1 (first impulse + 3 ticks), 0xFFFF = over 4ms	us
+unsigned char statBootWarm = 0;						//1 -> statBoot of warm boot
+
+#define STAT_ENTER() unsigned int statEntry = TCNT1
+#define STAT_EXIT(vector) statUpdate(vector, statEntry)
+#define STAT_LATENCY(vector, latency) if ((latency) > statLatency[vector]) statLatency[vector] = (latency)
+#else
+#define STAT_ENTER()
+#define STAT_EXIT(vector)
+#define STAT_LATENCY(vector, latency)
+#endif
 
-const unsigned char tabSpeed[245] PROGMEM = {247,227,209,194,181,170,160,151,143,136,130,124,119,114,109,105,101,97,94,91,88,85,83,80,78,76,74,72,70,68,67,65,64,62,61,60,58,57,56,55,54,53,52,51,50,49,48,47,47,46,45,44,44,43,42,42,41,40,40,39,39,38,38,37,37,36,36,35,35,34,34,34,33,33,32,32,32,31,31,31,30,30,30,29,29,29,28,28,28,28,27,27,27,27,26,26,26,26,25,25,25,25,25,24,24,24,24,24,23,23,23,23,23,22,22,22,22,22,22,21,21,21,21,21,21,20,20,20,20,20,20,20,19,19,19,19,19,19,19,19,18,18,18,18,18,18,18,18,18,17,17,17,17,17,17,17,17,17,17,16,16,16,16,16,16,16,16,16,16,16,15,15,15,15,15,15,15,15,15,15,15,15,15,14,14,14,14,14,14,14,14,14,14,14,14,14,14,14,13,13,13,13,13,13,13,13,13,13,13,13,13,13,13,13,13,13,12,12,12,12,12,12,12,12,12,12,12,12,12,12,12,12,12,12,12,12,11,11,11,11,11,11,11,11,0};
 
 /*----------------------------------
 	Functions:
 ----------------------------------*/
 
-//PII regulation !!!ZKONTROLOVAT!!!
-inline unsigned char regulator()
-{	
-	unsigned int realCurrent;//0 - 65 535 (0 - 12 800A), 255 = 50A
-	unsigned int delta;//-32768 - +32767
-	unsigned int pom;
-	
-	if (wantedCurrent <= 1)//no acceleration wanted -> wanted speed = 0
-	{
-		sum2=0;
-		sum1=0;
-		current0 = actualCurrent;
-		return 0;		
-	}	
+//function for analog measure, return last value measured by ADC_vect
+//255=4.7V; 0 = 0V
+static inline unsigned char Measure(unsigned char input_pin, unsigned char min, unsigned char max)
+{
+	return convertRange(adcResult[input_pin], min, max);
+}
+
+//increment of decimal counter (most significant digit first)
+static inline void incrementDigits(unsigned char *digits)
+{
+	unsigned char i = DISPLAY_NUMBER_DIGITS;
 	
-	/*if (wantedAcceleration < 5)
+	while (i > 0)
 	{
-		sum2 = wantedAcceleration << 7;
-		sum1 = 0;
-		return wantedAcceleration;
+		i--;
+		if (digits[i] < 9)
+		{
+			digits[i]++;
+			return;
+		}
+		digits[i] = 0;
 	}
+}
+
+#if ISR_STATS
+//adds execution time of interrupt to statistics (called at its end)
+static inline void statUpdate(unsigned char vector, unsigned int entry)
+{
+	unsigned int time = TCNT1;
+	
+	if (time < entry) time += SERVO_PERIOD;//timer 1 restarted, max. one period
+	time -= entry;
 	
-	if (wantedSpeed > 10) realCurrent = (actualCurrent*(unsigned int)256)/wantedSpeed;
-	else realCurrent = 0;*/
+	if (time > statMax[vector]) statMax[vector] = time;
+	statAverage[vector] += time - (statAverage[vector] >> 3);
+}
+
+//16b statistic read from main loop
+static inline unsigned int statRead(volatile unsigned int *value)
+{
+	unsigned int result;
 	
-	//linearized real current
-	realCurrent = ((actualCurrent - (unsigned int)current0)*(768 - 2 * wantedSpeed)) >> 8;
+	cli();
+	result = *value;
+	sei();
+	return result;
+}
+
+//average execution time of vector (ticks), read from main loop
+static inline unsigned int statAverageRead(unsigned char vector)
+{
+	unsigned long result;
 	
-	/*if (realCurrent > 256) // real current is 50A - no more accelerate
+	cli();
+	result = statAverage[vector];
+	sei();
+	return result >> 3;
+}
+
+//clears all statistics
+static inline void statClear()
+{
+	cli();
+	for (unsigned char i = 0; i < STAT_VECTORS; i++)
+	{
+		statMax[i] = 0;
+		statAverage[i] = 0;
+		statLatency[i] = 0;
+	}
+	statLate = 0;
+	statMissed = 0;
+	sei();
+}
+
+//page of statistics: vector - max time, average / max latency (us), frames - late and missed count,
+//main loop tasks - overruns, boot time
+static inline void statRedraw()
+{
+	displayBufferSetPosition(0,0);
+	if (statPage == STAT_PAGES)
 	{
-		return(sum2 >> 6);
-	} 
-	else if(realCurrent > 512) // real current is 100A !!! -> slow down
+		displayBufferWriteDataArray("Boot ");
+		displayBufferWriteDataArray(statBootWarm ? "wrm" : "cld");
+		displayBufferSetPosition(1,0);
+		displayBufferWriteUInt(statBoot,5,0);
+		displayBufferWriteDataArray(" us");
+	}
+	else if (statPage == STAT_PAGES - 1)
 	{
-		wantedAcceleration = 0;
-	}*/	
+		unsigned int overruns = 0;
 		
-	//acceleration - positive delta
-	if (wantedCurrent >= realCurrent)
-	{	
-		delta = wantedCurrent - realCurrent;
-		
-		//sum 1: 0 - 32 767
-		if (sum1 + delta < 16384) sum1 += delta;
-		else sum1 = 16383;		
+		for (unsigned char i = 0; i < TASKS; i++) overruns += tasks[i].overruns;
+		displayBufferWriteDataArray("Task ovr");
+		displayBufferSetPosition(1,0);
+		displayBufferWriteUInt(overruns,8,0);
+	}
+	else if (statPage <= STAT_VECTORS)
+	{
+		unsigned char vector = statPage - 1;
 		
-		//sum 2
-		pom = (sum1 >> 6);
-		if ( sum2 + pom < 16384)
-		{ 
-			sum2 += pom;
-			if (sum2 + delta < 16384) sum2 += delta;						
-		}
-		else sum2 = 16383;
-	} 
-	
-	// slow down - negative delta
+		displayBufferWriteDataArray((char*)statNames[vector]);
+		displayBufferWriteUInt(statRead(&statMax[vector]) / SERVO_TICKS_US,5,0);
+		displayBufferSetPosition(1,0);
+		displayBufferWriteUInt(statAverageRead(vector) / SERVO_TICKS_US,3,0);
+		displayBufferWriteData('/');
+		displayBufferWriteUInt(statRead(&statLatency[vector]) / SERVO_TICKS_US,4,0);
+	}
 	else
-	{	
-		delta =  realCurrent - wantedCurrent;	
-		
-		//sum 1: 0 - 32 767
-		if (sum1 > delta) sum1 -= delta;
-		else sum1 = 0;		
-		
-		pom = 255 - (sum1 >> 6);
-		
-		//sum 2
-		if ( sum2 > delta)
-		{ 
-			sum2 -= delta;
-			if (sum2 > pom) sum2 -= pom;						
-		}
-		else sum2 = 0;
+	{
+		displayBufferWriteDataArray("Late");
+		displayBufferWriteUInt(statRead(&statLate),4,0);
+		displayBufferSetPosition(1,0);
+		displayBufferWriteDataArray("Miss");
+		displayBufferWriteUInt(statRead(&statMissed),4,0);
 	}
-		
-	return(sum2 >> 6);
+	displayBufferClearLine();
 }
+#endif
 
-//function for analog measure, return measured value
-//255=4.7V; 0 = 0V
-inline unsigned char Measure(unsigned char input_pin, unsigned char min, unsigned char max)
+#if ADC_NOISE_REDUCTION
+//one ADC conversion in ADC Noise Reduction sleep (CPU and timers 0, 1 are stopped)
+//only between end of servo pulse and next period, when display queue is empty
+//and no timer 1 compare match is near, stopped time is added to timer 1
+//return 1 if conversion was done
+static inline unsigned char adcSleepConversion()
 {
-	//REFS1 REFS0 ADLAR - MUX3 MUX2 MUX1 MUX0
-	ADMUX = 0x20 + input_pin;		
-	
-	//ADEN ADSC ADFR ADIF ADIE ADPS2 ADPS1 ADPS0
-	ADCSRA = 0xC6;		//start conversion, divide clk 64
-	
-	
-	while(readBit(ADCSRA, 6)); //wait until conversion is complete
-	
-	//unsigned char measured = 0;
-	
-	if (ADCH < min)
+	cli();
+#if SERVO_HW_PWM
+	if (TCNT1 <= OCR1B + ADC_SLEEP_MARGIN1 || TCNT1 >= ICR1 - ADC_SLEEP_MARGIN1
+#else
+	if (readBit(OUTPUT,SW) || TCNT1 >= OCR1A - ADC_SLEEP_MARGIN1
+#endif
+		|| displayQueueHead != displayQueueTail || displayQueueHold)
 	{
+		sei();
 		return 0;
-	} 
-	else if (ADCH > max)
-	{
-		return (max-min);		
 	}
-	else
+	
+	adcDone = 0;
+	set_sleep_mode(SLEEP_MODE_ADC);
+	sleep_enable();
+	while (!adcDone)//conversion starts by entering sleep, other interrupt can wake CPU before its end
 	{
-		return (ADCH - min);
+		sei();
+		sleep_cpu();//instruction after sei is executed before any interrupt
+		cli();
 	}
+	sleep_disable();
+	
+	TCNT1 += ADC_SLEEP_TICKS1;
+	sei();
+	return 1;
+}
+#endif
+
+//moves next run of task (display hold after button press)
+static inline void taskDelay(unsigned char index, unsigned char ticks)
+{
+	tasks[index].next = frameCounter + ticks;
+}
 
-	//return measured;	
+//timer 1 timestamp = servoTime + TCNT1 (call with interrupts disabled),
+//frame interrupt can be pending (TCNT1 already restarted from 0)
+static inline unsigned long timerTime()
+{
+	unsigned int ticks = TCNT1;
+	unsigned long time = servoTime;
+#if SERVO_HW_PWM
+	if (readBit(TIFR,TOV1) && ticks < SERVO_PERIOD / 2) time += SERVO_PERIOD;
+#else
+	if (readBit(TIFR,OCF1A) && ticks < SERVO_PERIOD / 2) time += SERVO_PERIOD;
+#endif
+	return time + ticks;
 }
 
-// convert unsigned int to char array 
-void toCharArray(unsigned char *array, unsigned int number)
+//copies actual values into free snapshot buffer and makes it valid
+//(called from interrupt or with interrupts disabled)
+static inline void snapshotPublish()
 {
-	uint8_t i = 0,j=0;
-	char pom;
+	volatile struct snapshot *snapshot = &snapshots[(snapshotSequence + 1) & 1];
 	
-	if (number==0)
+	for (unsigned char i = 0; i < DISPLAY_NUMBER_DIGITS; i++)
 	{
-		array[i] = '0';
-		i++;
+		snapshot->distanceMeters[i] = distanceMeters[i];
+		snapshot->totalDistanceMeters[i] = totalDistanceMeters[i];
 	}
-	while (number>0 && i<8)
+	snapshot->consumedCapacity = consumedCapacity;
+	snapshot->totalConsumedAh = totalConsumedAh;
+	snapshotSequence++;
+}
+
+//CRC of session copy (without crc member)
+static inline unsigned int sessionCrc(struct session *session)
+{
+	unsigned char *data = (unsigned char*)session;
+	unsigned int crc = 0xFFFF;
+	
+	for (unsigned char i = 0; i < sizeof(struct session) - sizeof(session->crc); i++)
 	{
-		array[i] = (number % 10) + '0';
-		number/=10;
-		i++;
+		crc = _crc_ccitt_update(crc, data[i]);
 	}
-	array[i]='\0';
+	return crc;
+}
+
+//saves session into older copy, values are copied with interrupts disabled, CRC is computed after
+static inline void sessionSave()
+{
+	struct session *session = &sessions[sessionIndex];
+	
+	session->crc = 0;//copy is invalid while it is written
+	cli();
+	for (unsigned char i = 0; i < DISPLAY_NUMBER_DIGITS; i++) session->distanceMeters[i] = distanceMeters[i];
+	session->distanceFraction = distanceFraction;
+	session->totalDistance = totalDistance;
+	session->consumedCapacity = consumedCapacity;
+	session->consumedCapacityFraction = consumedCapacityFraction;
+	session->totalConsumedCapacity = totalConsumedCapacity;
+#if ESC_REGULATOR == 1
+	session->regIntegral = regIntegral;
+	session->regErrorSum = regErrorSum;
+	session->regOutput = regOutput;
+	session->regCurrent0 = regCurrent0;
+	session->regActive = regActive;
+#elif ESC_REGULATOR == 2
+	session->regSum1 = regSum1;
+	session->regSum2 = regSum2;
+#endif
+	sei();
+	session->lineMode = LineMode;
+	session->sequence = sessionSequence++;
+	session->crc = sessionCrc(session);
+	
+	sessionIndex ^= 1;
+}
+
+//restores newer valid session copy (before interrupts are enabled), return 1 if restored
+static inline unsigned char sessionRestore()
+{
+	unsigned char valid0 = sessionCrc(&sessions[0]) == sessions[0].crc;
+	unsigned char valid1 = sessionCrc(&sessions[1]) == sessions[1].crc;
+	struct session *session;
+	
+	if (!valid0 && !valid1) return 0;
 	
-	for (j=0;j<(i/2);j++)
+	if (valid0 && valid1) sessionIndex = (signed char)(sessions[1].sequence - sessions[0].sequence) > 0;
+	else sessionIndex = valid1;
+	session = &sessions[sessionIndex];
+	
+	for (unsigned char i = 0; i < DISPLAY_NUMBER_DIGITS; i++) distanceMeters[i] = session->distanceMeters[i];
+	distanceFraction = session->distanceFraction;
+	totalDistance = session->totalDistance;
+	consumedCapacity = session->consumedCapacity;
+	consumedCapacityFraction = session->consumedCapacityFraction;
+	totalConsumedCapacity = session->totalConsumedCapacity;
+	LineMode = session->lineMode;
+#if ESC_REGULATOR == 1
+	regIntegral = session->regIntegral;
+	regErrorSum = session->regErrorSum;
+	regOutput = session->regOutput;
+	regCurrent0 = session->regCurrent0;
+	regActive = session->regActive;
+#elif ESC_REGULATOR == 2
+	regSum1 = session->regSum1;
+	regSum2 = session->regSum2;
+#endif
+	
+	//restored copy stays valid, next save writes other one
+	sessionSequence = session->sequence + 1;
+	sessionIndex ^= 1;
+	return 1;
+}
+
+#if EEPROM_MIGRATE
+//converts totals of old sources (addresses 10, 20, 30) to actual layout (15, 25, 35, 36),
+//only if actual layout was never written and old one was
+static inline void eepromMigrate()
+{
+	unsigned long capacity;
+	unsigned char lineMode;
+	
+	if (eeprom_read_dword((uint32_t*)15) != 0xFFFFFFFF || eeprom_read_dword((uint32_t*)10) == 0xFFFFFFFF) return;
+	
+	capacity = eeprom_read_dword((uint32_t*)20);//256/922 mAh
+	if (capacity == 0xFFFFFFFF) capacity = 0;
+	capacity = (capacity / 922) * 256 + (capacity % 922) * 256 / 922;//mAh without overflow
+	
+	lineMode = eeprom_read_byte((uint8_t*)30);//line 2 * 10 + line 1
+	lineMode = lineMode <= 88 ? (lineMode / 10) * 16 + lineMode % 10 : 0x31;
+	
+	eeprom_update_dword((uint32_t*)15,eeprom_read_dword((uint32_t*)10));
+	eeprom_update_dword((uint32_t*)25,capacity);
+	eeprom_update_byte((uint8_t*)35,lineMode);
+	eeprom_update_word((uint16_t*)36,0);
+}
+#endif
+
+//coherent copy of last snapshot for main loop, interrupts stay enabled
+//(publish during copy -> copy again)
+static inline void snapshotRead(struct snapshot *copy)
+{
+	unsigned char sequence;
+	
+	do
 	{
-		pom = array[j];
-		array[j] = array[i-j-1];
-		array[i-j-1] = pom;
-	}
+		sequence = snapshotSequence;
+		*copy = snapshots[sequence & 1];
+	} while (sequence != snapshotSequence);
+}
+
+//current from 12b oversampled value, 0-255 (255 = 50A)
+static inline unsigned char MeasureCurrent()
+{
+	return convertCurrent(currentSample[currentSampleIndex]);
+}
+
+//wheel speed 1/10 km/h from average of last cycle periods (called from main loop, 32b division)
+static inline unsigned int getSpeed()
+{
+	unsigned long sum;
+	unsigned char count;
+	
+	cli();
+	sum = cyclePeriodSum;
+	count = cyclePeriodCount;
+	sei();
+	
+	if (count == 0) return 0;//stopped
+	if (sum <= SPEED_CONSTANT / SPEED_MAX * count) return SPEED_MAX;
+	return SPEED_CONSTANT * count / sum;
 }
 
 //show on display which value is selected
-inline void displayShowMode(char mode)
+static inline void displayShowMode(char mode)
 {
-			displayPausedCounter = 50;
-			displayPaused = 1;
+			taskDelay(TASK_DISPLAY,50);//name is shown for 1s
 
 			switch(mode)
 			{
 				case 1:
-					displayWriteDataArray("Tot.dist");
+					displayBufferWriteDataArray("Tot.dist");
 					break;
 				case 2:
-					displayWriteDataArray("Tot.cons");
+					displayBufferWriteDataArray("Tot.cons");
 					break;
 				case 3:
-					displayWriteDataArray("Distance");
+					displayBufferWriteDataArray("Distance");
 					break;
 				case 4:
-					displayWriteDataArray("Consumed");
+					displayBufferWriteDataArray("Consumed");
 					break;
 				case 5:
-					displayWriteDataArray("Rest cap");
+					displayBufferWriteDataArray("Rest cap");
 					break;
 				case 6:
-					displayWriteDataArray("Accu.   ");
+					displayBufferWriteDataArray("Accu.   ");
 					break;
 				case 7:
-					displayWriteDataArray("Current ");
+					displayBufferWriteDataArray("Current ");
 					break;
 				case 8:
-					displayWriteDataArray("Speed   ");
+					displayBufferWriteDataArray("Speed   ");
 					break;
 					
 			}
 }
 
 //check if button pressed, change display line mode or clear distance and consumed capacity
-inline void checkButton()
+static inline void checkButton()
 {
+#if ISR_STATS
+	//hidden statistics display
+	if (statPage)
+	{
+		if (lastButtonState != 0x03-(PINC & 0x03))
+		{
+			lastButtonState = 0x03-(PINC & 0x03);
+			if (lastButtonState == 1) statPage = statPage < STAT_PAGES ? statPage + 1 : 0;//after last page normal display
+			if (lastButtonState == 2) statClear();
+		}
+		return;
+	}
+	
+	if (lastButtonState == 1 && (0x03-(PINC & 0x03)) == 1)
+	{
+		statHold++;
+		if (statHold >= STAT_HOLD)
+		{
+			statHold = 0;
+			statPage = 1;
+			return;
+		}
+	}
+	else statHold = 0;
+#endif
 
 	if(lastButtonState != 0x03-(PINC & 0x03))
 	{
@@ -311,7 +850,7 @@ inline void checkButton()
 				} while (LineMode % 16 == LineMode / 16);
 				
 				//show line mode			
-				displaySetAddressDDRAM(0x00);
+				displayBufferSetPosition(0,0);
 				displayShowMode(LineMode % 16);	
 			break;
 		
@@ -329,14 +868,17 @@ inline void checkButton()
 				} while (LineMode % 16 == LineMode /16);
 				
 				//show line mode
-				displaySetAddressDDRAM(0x40);
+				displayBufferSetPosition(1,0);
 				displayShowMode(LineMode / 16);
 			break;
 		
 			case 3://booth button pressed - reset distance and consumed capacity
-				distance=0;
-				totalConsumedCapacity += (consumedCapacity/922);
-				consumedCapacity=0;
+				cli();
+				for (unsigned char i=0;i<DISPLAY_NUMBER_DIGITS;i++) distanceMeters[i]=0;
+				distanceFraction=0;
+				consumedCapacity=0;//fraction stays, it is part of total consumed capacity
+				snapshotPublish();
+				sei();
 			break;
 		
 		}
@@ -345,204 +887,598 @@ inline void checkButton()
 }
 
 //function for refresh display 
-inline void displayRedraw()
+static inline void displayRedraw()
 {
-	char array[8];
 	unsigned char xlineMode = 0;
+	struct snapshot values;
 	
-	if(displayPaused == 0){
+#if ISR_STATS
+	if (statPage)
+	{
+		statRedraw();
+		return;
+	}
+#endif
+	
+	snapshotRead(&values);
 	for (int line=0;line<2;line++) //for booth lines
 	{
 		if (line)// line 2
 		{
-			displaySetAddressDDRAM(0x40);
+			displayBufferSetPosition(1,0);
 			xlineMode = (LineMode / 16);
 		} 
 		else //line 1
 		{
-			displaySetAddressDDRAM(0x00);			
+			displayBufferSetPosition(0,0);			
 			xlineMode = (LineMode % 16);
 		}
 			
 		switch(xlineMode)
 		{
 			case 1://1 total distance
-				toCharArray(&array,(totalDistance*395)>>20); //distance*0.000377 = dist in kilometers	
-				//toCharArray(&array,(totalDistance*0.000377));
-				displayWriteDataArray(array);
-				displayWriteDataArray(" km");		
+				displayBufferWriteDigits(values.totalDistanceMeters,DISPLAY_NUMBER_DIGITS-3,0,0); //meters without last 3 digits = kilometers	
+				displayBufferWriteDataArray(" km");		
 			break;
 		
 			case 2://2 total consumed capacity
-				toCharArray(&array,(totalConsumedCapacity)/1000 + consumedCapacity/921600);//show in Ah		
-				displayWriteDataArray(array);
-				displayWriteDataArray(" Ah");
+				displayBufferWriteUInt(values.totalConsumedAh,0,0);//show in Ah		
+				displayBufferWriteDataArray(" Ah");
 			break;
 	
 			case 3://3 distance
-				toCharArray(&array,(distance*386)>>10); //distance*0.377 = dist in meters
-				//toCharArray(&array,(distance*0.377));
-				displayWriteDataArray(array);
-				displayWriteDataArray(" m");
+				displayBufferWriteDigits(values.distanceMeters,DISPLAY_NUMBER_DIGITS,0,0);
+				displayBufferWriteDataArray(" m");
 			break;
 	
 			case 4://4 consumed capacity (mAh)
-				toCharArray(&array,consumedCapacity/922);	//consumed capacity/256/3600 = mAh
-				displayWriteDataArray(array);
-				displayWriteDataArray(" mAh");
+				displayBufferWriteULong(values.consumedCapacity,0,0);
+				displayBufferWriteDataArray(" mAh");
 			break;
 	
 			case 5://5 rest capacity (%)
-				if (actualVoltage>=180)	displayWriteDataArray("100 %");
+				if (actualVoltage>=VOLTAGE_EMPTY+100)	displayBufferWriteDataArray("100 %");
 				
-				else if (actualVoltage>=80)
+				else if (actualVoltage>=VOLTAGE_EMPTY)
 				{
-					toCharArray(&array,(actualVoltage-80));
-					displayWriteDataArray(array);
-					displayWriteDataArray(" %");
+					displayBufferWriteUChar(actualVoltage-VOLTAGE_EMPTY,0,0);
+					displayBufferWriteDataArray(" %");
 				} 
 				
-				else displayWriteDataArray("!  0 % !");									
+				else displayBufferWriteDataArray("!  0 % !");									
 				
 			break;
 	
 			case 6://6 voltage
-				toCharArray(&array,(10 + actualVoltage/25));	//10V + 1/25V 100 = 4V
-				displayWriteDataArray(array);
-				displayWriteData('.');
-				toCharArray(&array,((actualVoltage%25) * 4)/10);	//25 = 1V 24*4 /10 = 96/10 = 9
-				displayWriteDataArray(array);				
-				displayWriteDataArray(" V");
+				displayBufferWriteUInt(VOLTAGE_TENTHS(actualVoltage),0,1);
+				displayBufferWriteDataArray(" V");
 			break;
 	
 			case 7://7 current
-				toCharArray(&array,actualCurrent/5);		
-				displayWriteDataArray(array);
-				displayWriteDataArray(" A");
+				displayBufferWriteUChar((actualCurrent*(unsigned int)205)>>10,0,0);	//205/1024 = 1/5		
+				displayBufferWriteDataArray(" A");
 			break;
 	
 			case 8://8 speed
-				toCharArray(&array,actualSpeed/4);		
-				displayWriteDataArray(array);
-				displayWriteData('.');
-				toCharArray(&array,(actualSpeed % 4)*10/4);		
-				displayWriteDataArray(array);
-				displayWriteDataArray("km/h");
+				displayBufferWriteUInt(getSpeed(),0,1);	//1/10 km/h
+				displayBufferWriteDataArray("km/h");
 			break;
 			
 			default:
-				displayWriteDataArray("Err     ");
+				displayBufferWriteDataArray("Err     ");
 			break;
 		}
-		displayWriteDataArray("     ");
+		displayBufferClearLine();
 	}
-	}	
 }
 
+//runs task
+static inline void taskRun(unsigned char index)
+{
+	switch (index)
+	{
+		case TASK_BUTTONS:
+			checkButton();
+		break;
+		
+		case TASK_DISPLAY:
+			displayRedraw();
+		break;
+		
+		case TASK_FLUSH:
+			displayFlush();//only fills display queue, sending is done by timer 0
+		break;
+		
+		case TASK_EEPROM:
+			eeprom_update_byte((uint8_t*)35,LineMode);//written only if changed
+		break;
+		
+		case TASK_SESSION:
+			sessionSave();
+		break;
+		
+		case TASK_PARKING:
+#if PARKING_TIMEOUT
+			//wheel sensor must be open, low level would wake up CPU immediately
+			if (wantedCurrent == 0 && speedTimeout == 0 && readBit(PIND,2)) parkingSeconds++;
+			else parkingSeconds = 0;
+#endif
+		break;
+	}
+}
+
+//return 1 if task should run
+static inline unsigned char taskDue(unsigned char index)
+{
+	return (signed char)(frameCounter - tasks[index].next) >= 0;
+}
+
+//runs all due tasks and counts overruns of their budget
+static inline void schedulerRun()
+{
+	for (unsigned char i = 0; i < TASKS; i++)
+	{
+		struct task *task = &tasks[i];
+		unsigned char now = frameCounter;
+		unsigned long start;
+		unsigned long time;
+		
+		if (!taskDue(i)) continue;
+		
+		task->next += task->period;
+		if ((signed char)(now - task->next) >= 0) task->next = now + task->period;//late more than period - runs are skipped
+		
+		cli();
+		start = timerTime();
+		sei();
+		
+		taskRun(i);
+		
+		cli();
+		time = timerTime() - start;
+		sei();
+		
+		if (time > task->budget) task->overruns++;
+	}
+}
+
+#if IDLE_SLEEP
+//sleep in idle mode (timers, ADC and external interrupts run) until next interrupt,
+//only if no task is due
+static inline void idleSleep()
+{
+	cli();
+	for (unsigned char i = 0; i < TASKS; i++)
+	{
+		if (taskDue(i))
+		{
+			sei();
+			return;
+		}
+	}
+	
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	sleep_enable();
+	sei();
+	sleep_cpu();//instruction after sei is executed before any interrupt - tick cannot be missed
+	sleep_disable();
+}
+#endif
+
+/*-------------------------------------------------------------
+TIMER1 configuration 
+generate of "servo" control PWM (period and impulse by ESC_PROTOCOL)
+--------------------------------------------------------------*/
+static inline void servoStart()
+{
+	//compare registers and counter are written while timer 1 is stopped, clock starts last
+	//(else compare match of first impulse can be missed and it comes one period later)
+#if SERVO_HW_PWM
+	//period (TOP + 1)
+	ICR1 = SERVO_PERIOD - 1;
+	
+	// compare register B - impulse
+	OCR1B = SERVO_MIN;//wantedSpeed = 0
+	
+	TCNT1 = SERVO_PERIOD - 3;//TOP 2 ticks after start, first impulse at next BOTTOM (write of TCNT1 is not a BOTTOM event)
+	
+	setBit(DDRB,2);//OC1B output
+	
+	//COM1A1 COM1A0 COM1B1 COM1B0 FOC1A FOC1B WGM11 WGM10
+	TCCR1A = 0x22; //OC1B set at BOTTOM, cleared on compare match, fast PWM TOP = ICR1
+	
+	//ICNC1 ICES1 - WGM13 WGM12 CS12 CS11 CS10
+	TCCR1B = 0x18 + SERVO_CLK; //fast PWM TOP = ICR1, prescaler by ESC_PROTOCOL
+#else
+	//compare register A - period
+	OCR1A = SERVO_PERIOD - 1;
+	
+	// compare register B - impulse
+	OCR1B = SERVO_MIN;//wantedSpeed = 0
+	
+	TCNT1 = SERVO_PERIOD - 3;//compare match A (first impulse) 2 ticks after start, write blocks match in next tick
+	
+	//COM1A1 COM1A0 COM1B1 COM1B0 FOC1A FOC1B WGM11 WGM10
+	TCCR1A = 0x00; //Normal port operation, OC1A/OC1B disconnected, normal mode
+	
+	//ICNC1 ICES1  WGM13 WGM12 CS12 CS11 CS10
+	TCCR1B = 0x08 + SERVO_CLK; //CTC mode, prescaler by ESC_PROTOCOL
+#endif
+}
+
+/*-------------------------------------------------------------
+ADC configuration 
+first conversion, next are started by ADC_vect
+-------------------------------------------------------------*/
+static inline void adcStart()
+{
+	//REFS1 REFS0 ADLAR - MUX3 MUX2 MUX1 MUX0
+	ADMUX = adcInputs[adcIndex];	//10b result
+	
+#if ADC_NOISE_REDUCTION
+	//ADEN ADSC ADFR ADIF ADIE ADPS2 ADPS1 ADPS0
+	ADCSRA = 0x8E;		//interrupt enabled, divide clk 64, conversion is started by sleep
+#else
+	//ADEN ADSC ADFR ADIF ADIE ADPS2 ADPS1 ADPS0
+	ADCSRA = 0xCE;		//start conversion, interrupt enabled, divide clk 64
+#endif
+}
+
+#if PARKING_TIMEOUT
+//parking: display off, servo impulses and ADC stopped, power-down sleep
+//(only low level of INT0 / INT1 wakes up ATmega8 - buttons on port C cannot),
+//RAM is kept -> after wake up only timer 1, ADC and display are switched on again
+static inline void parkingSleep()
+{
+	parkingSeconds = 0;
+	
+	displaySetOn(0);//DDRAM content is kept
+	displayQueueWait();
+	
+	//wait for end of impulse, ESC gets last complete impulse with wantedSpeed = 0,
+	//pending interrupts are served in the loop (instruction after sei is always executed
+	//before an interrupt, nop gives them a slot before cli)
+	cli();
+	while (TCNT1 <= OCR1B)
+	{
+		sei();
+		__asm__ __volatile__ ("nop");
+		cli();
+	}
+	
+	TCCR1B = 0;//timer 1 stopped
+#if SERVO_HW_PWM
+	TCCR1A = 0;//OC1B disconnected
+	clearBit(PORTB,2);
+#else
+	clearBit(OUTPUT,SW);
+#endif
+	clearBit(OUTPUT,SF);//fan off
+	ADCSRA = 0;//ADC off
+	
+	//SE SM2 SM1 SM0 ISC11 ISC10 ISC01 ISC00 
+	MCUCR &= 0xF0;//both interrupts on low level (edge does not wake up from power-down)
+	
+	set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+	sleep_enable();
+	sei();
+	sleep_cpu();//INT0 interrupt counts wheel cycle, it is repeated while level is low (no timer -> bounce)
+	cli();
+	sleep_disable();
+	
+	setBit(MCUCR,1);//both interrupts on falling edge again
+	setBit(MCUCR,3);
+	GIFR = 0xC0;//clear flags set by low level
+	//TOV1 OCF1A OCF1B - flags of last period
+	TIFR = 0x1C;
+	
+	servoStart();
+	adcStart();
+	sei();
+	
+	displaySetOn(1);
+	taskDelay(TASK_DISPLAY,0);//live data immediately
+	taskDelay(TASK_FLUSH,0);
+}
+#endif
+
 
 
 /*---------------------------------------------
 Interrupt routines
 ----------------------------------------------*/
 
-// interrupt timer 1 - compare match A - every 20ms
-ISR(TIMER1_COMPA_vect)			//auto reload OCR1A - CTC mode
+#if SERVO_HW_PWM
+#define SERVO_FRAME_vect TIMER1_OVF_vect		//TOP = ICR1, pulse is started by timer
+#else
+#define SERVO_FRAME_vect TIMER1_COMPA_vect	//auto reload OCR1A - CTC mode
+#endif
+
+// interrupt timer 1 - compare match A (overflow in SERVO_HW_PWM mode) - every frame (20ms, 2.5ms, 0.5ms)
+ISR(SERVO_FRAME_vect)
 {
+	STAT_ENTER();
+#if ISR_STATS
+	//timer 1 restarted at frame start -> TCNT1 is latency
+	STAT_LATENCY(STAT_FRAME, statEntry);
+	if (statEntry > STAT_LATE) statLate++;
+	if (!statFrameDone) statMissed++;
+	statFrameDone = 0;
+#endif
+#if !SERVO_HW_PWM
 	setBit(OUTPUT,SW);			//start PWM pulse for controller
-	OCR1BL = 128 + (wantedSpeed >> 1);//sets PWM impulse width 1-2ms (0-127)
+	OCR1B = SERVO_MIN + wantedSpeed;//sets PWM impulse width (0-1023)
+#endif
+	servoTime += SERVO_PERIOD;
+	
+	//next part every 20ms
+	frameDivider++;
+	if (frameDivider < FRAMES_PER_20MS)
+	{
+		STAT_EXIT(STAT_FRAME);
+		return;
+	}
+	frameDivider = 0;
+	
+	frameCounter++;
+	
+	snapshotPublish();//values for main loop
+	
+	//wheel stopped
+	if (speedTimeout) speedTimeout--;
+	else
+	{
+		cyclePeriodCount = 0;
+		cyclePeriodSum = 0;
+	}
+	
+	STAT_EXIT(STAT_FRAME);
+}
+
+#if ESC_REGULATOR == 2
+//PI regulator of ESC_prog_2.c, output 0-1023
+static inline unsigned int regulatorLegacy(unsigned char wanted, unsigned char actual)
+{
+	unsigned char output;
+	
+	if (wanted>=actual)
+	{
+		if (regSum1<248) regSum1 += (wanted-actual) >> 5;
+		if (regSum2<15872) regSum2 += (regSum1+(wanted-actual));
+	}
+	else
+	{
+		if (regSum1>7) regSum1 -= (wanted-actual)>>5;
+		if (regSum2>511) regSum2 -= (regSum1+(wanted-actual));
+	}
+	
+	output = regSum2>>6;
+	return ((unsigned int)output << 2) | (output >> 6);//0-255 -> 0-1023
+}
+#endif
+
+// interrupt timer 1 - compare match B - end of impulse
+ISR(TIMER1_COMPB_vect)
+{
+	STAT_ENTER();
+#if !SERVO_HW_PWM
+	clearBit(OUTPUT,SW);		//end of PWM impulse	
+#endif
+#if ISR_STATS
+	STAT_LATENCY(STAT_COMPB, statEntry - OCR1B);
+	statFrameDone = 1;
+#endif
 	
+	//inputs are read just before regulator (shortest latency)
 	/*	CURRENT
 		0A - min 0.6V = 33
 		50A - max 2.6V = 141 */
-	actualCurrent = pgm_read_byte(&tabI[Measure(SI,33,141)]);
+	actualCurrent = MeasureCurrent();
 	
 	/*	ACELERATION
 		min 0.86V = 51
 		max 4.5V = 244 */
-	wantedCurrent = pgm_read_byte(&tabA[Measure(SA,51,244)]);
+	wantedCurrent = convertAcceleration(adcResult[SA]);
 	
-	//display pause timer decrement
-	if(displayPaused == 1)
-		{
-			if (displayPausedCounter <= 0)
-			{
-				displayPaused = 0;
-			}
-			else
-			{
-				displayPausedCounter--;
-			}
-		}
-}
-
-// interrupt timer 1 - compare match B - after 1-2ms
-ISR(TIMER1_COMPB_vect)
-{
-	clearBit(OUTPUT,SW);		//end of PWM impulse	
+#if ESC_REGULATOR == 1
+	wantedSpeed = regulator(wantedCurrent, actualCurrent);//every frame, gains scaled by REG_FRAMES
+#elif ESC_REGULATOR == 2
+	//law of ESC_prog_2.c is defined for 50Hz - step in frame of 20ms tick, output is held in other frames
+	if (frameDivider == 0) wantedSpeed = regulatorLegacy(wantedCurrent, actualCurrent);
+#else
+	wantedSpeed = ((unsigned int)wantedCurrent << 2) | (wantedCurrent >> 6);//0-255 -> 0-1023
+#endif
 	
-	wantedSpeed = regulator();
+#if SERVO_HW_PWM
+	OCR1B = SERVO_MIN + wantedSpeed;//impulse width 1-2ms of next period (double buffered, updated at TOP)
+#endif
 	
-	consumedCapacity += actualCurrent+1;	//increment of consumed capacity
+	//increment of consumed capacity every 20ms, max. 256 -> max. one carry
+#if ADC_NOISE_REDUCTION
+	//conversions only in gaps of frame - current of last oversampling window
+	consumedCapacityFraction += actualCurrent+1;
+#else
+	//average of every current conversion of last 20ms (about 90), not only last oversampling window
+	if (frameDivider == 0)
+	{
+		if (capacitySampleCount) consumedCapacityFraction += (capacitySampleSum + (capacitySampleCount >> 1)) / capacitySampleCount + 1;
+		else consumedCapacityFraction += actualCurrent+1;
+		capacitySampleSum = 0;
+		capacitySampleCount = 0;
+	}
+#endif
+	if (consumedCapacityFraction >= CAPACITY_UNIT)
+	{
+		consumedCapacityFraction -= CAPACITY_UNIT;
+		consumedCapacity++;
+		totalConsumedCapacity++;
 		
-	if (wantedCurrent > 0) setBit(OUTPUT,SF); //fan on 
-	else clearBit(OUTPUT,SF); //fan off
-	
-	if (actualCurrent < 10)//voltage measure if current is low (I<2A), fan is off
+		if (totalConsumedAhFraction < 999)
+		{
+			totalConsumedAhFraction++;
+		}
+		else
+		{
+			totalConsumedAhFraction = 0;
+			totalConsumedAh++;
+		}
+	}
+		
+	/*	VOLTAGE
+		11.4V = 38
+		12.8V - min 1.4V = 76
+		16.8V - max 3.4V = 184 */
+#if FAN_POLICY == 1
+	if (actualCurrent>10) setBit(OUTPUT,SF); //current is higher than 2A - fan on
+	else//voltage measure if current is low (I<2A), fan is off
 	{
-		/*	VOLTAGE
-			11.4V = 38
-			12.8V - min 1.4V = 76
-			16.8V - max 3.4V = 184 */
-		actualVoltage = Measure(SU,0,180);
+		actualVoltage = Measure(SU,VOLTAGE_ADC_MIN,180);
+		clearBit(OUTPUT,SF);
 	}
+#else
+#if FAN_POLICY == 0
+	if (wantedCurrent > 0) setBit(OUTPUT,SF); //fan on 
+	else clearBit(OUTPUT,SF); //fan off
+#endif
+	actualVoltage = Measure(SU,VOLTAGE_ADC_MIN,180);
+#endif
 	
+	STAT_EXIT(STAT_COMPB);
 }
 
-// interrupt timer 2 - compare match, auto reload - every 2ms
-ISR(TIMER2_COMP_vect) //cycle time counter, count up to 255
+// ADC conversion complete - every 104us, round robin SI, SA, SI, SU (current every 208us)
+ISR(ADC_vect)
 {
-	if (CycleTime<255)
+	STAT_ENTER();
+	unsigned char input = adcInputs[adcIndex];
+	unsigned int measured = ADCW;	//10b result
+	
+	if (input == SI)//current - oversampling and decimation
 	{
-		CycleTime++;
+#if !ADC_NOISE_REDUCTION
+		if (capacitySampleCount < 255)//max. 255 x 255
+		{
+			capacitySampleSum += convertCurrent(measured << 2);//10b -> 12b
+			capacitySampleCount++;
+		}
+#endif
+		currentSum += measured;
+		currentSumCount++;
+		if (currentSumCount >= CURRENT_OVERSAMPLING)
+		{
+			currentSample[currentSampleIndex ^ 1] = (currentSum << 2) >> CURRENT_OVERSAMPLING_SHIFT;//average of 10b -> 12b
+			currentSampleIndex ^= 1;
+			currentSum = 0;
+			currentSumCount = 0;
+		}
 	}
 	else
 	{
-		lastCyclePeriod=255;
-		actualSpeed=0;
+		adcResult[input] = measured >> 2;
 	}
+	
+	adcIndex++;
+	if (adcIndex >= ADC_INPUTS) adcIndex = 0;
+	
+	//REFS1 REFS0 ADLAR - MUX3 MUX2 MUX1 MUX0
+	ADMUX = adcInputs[adcIndex];	//10b result
+	
+#if ADC_NOISE_REDUCTION
+	adcDone = 1;		//next conversion is started by adcSleepConversion()
+#else
+	//ADEN ADSC ADFR ADIF ADIE ADPS2 ADPS1 ADPS0
+	ADCSRA = 0xCE;		//start next conversion, interrupt enabled, divide clk 64
+#endif
+	
+	STAT_EXIT(STAT_ADC);
 }
 
 // external interrupt 0 - cycle time measure, distance increment
 ISR(INT0_vect)
 {
-	lastCyclePeriod=CycleTime;
-	CycleTime=0;
+	STAT_ENTER();
+	unsigned long time = timerTime();
+	
+	if (speedTimeout)//first edge after stop has no period
+	{
+		unsigned long period = time - lastCycleTime;
+		
+		//contact bounce - too short, ignored (no distance)
+		//next edge is measured from last accepted one
+		if (period < SPEED_MIN_PERIOD)
+		{
+			STAT_EXIT(STAT_INT0);
+			return;
+		}
+		
+		//shorter than half of average (hard acceleration) - older periods are dropped from average,
+		//distance is counted for every accepted edge
+		if ((period * cyclePeriodCount) << 1 < cyclePeriodSum)
+		{
+			cyclePeriodCount = 0;
+			cyclePeriodSum = 0;
+		}
+		
+		//running sum, periods written before last stop are not in sum
+		if (cyclePeriodCount < SPEED_AVERAGING) cyclePeriodCount++;
+		else cyclePeriodSum -= cyclePeriods[cyclePeriodIndex];
+		cyclePeriods[cyclePeriodIndex] = period;
+		cyclePeriodSum += period;
+		cyclePeriodIndex = (cyclePeriodIndex + 1) & (SPEED_AVERAGING - 1);
+	}
+	lastCycleTime = time;
+	speedTimeout = SPEED_TIMEOUT;
 	
-	distance++;
 	totalDistance++;
 	
-	//actual speed, 11 = minimal period = 61,75km/h
-	if (lastCyclePeriod>10) actualSpeed=pgm_read_byte(&tabSpeed[lastCyclePeriod-11]); 
-	else actualSpeed=255;	
+	//decimal distance counters, circumference < 1m -> max. one carry per cycle
+	distanceFraction += WHEEL_CIRCUMFERENCE;
+	if (distanceFraction >= 1000)
+	{
+		distanceFraction -= 1000;
+		incrementDigits(distanceMeters);
+	}
+	
+	totalDistanceFraction += WHEEL_CIRCUMFERENCE;
+	if (totalDistanceFraction >= 1000)
+	{
+		totalDistanceFraction -= 1000;
+		incrementDigits(totalDistanceMeters);
+	}
+	
+	STAT_EXIT(STAT_INT0);
 }
 
+#if DISPLAY_ASYNC
+// interrupt timer 0 - overflow - every 50us while display queue is not empty
+ISR(TIMER0_OVF_vect)
+{
+	STAT_ENTER();
+	TCNT0 = 256 - DISPLAY_QUEUE_TICK;
+	displayQueueTick();		//send one byte to display
+	STAT_EXIT(STAT_DISPLAY);
+}
+#endif
+
 // external interrupt 1 - OFF signal
 ISR(INT1_vect)
 {
 	cli();//disable global interrupt
 	
-	totalConsumedCapacity += (consumedCapacity/922);
-	
 	//save data to EEPROM
 	eeprom_update_dword((uint32_t*)15,totalDistance);
 	eeprom_update_dword((uint32_t*)25,totalConsumedCapacity);
 	eeprom_update_byte((uint8_t*)35,LineMode);
+	eeprom_update_word((uint16_t*)36,consumedCapacityFraction);
 	
 	
-	displaySetAddressDDRAM(0x00);
-	displayWriteDataArray("  GOOD  ");
-	displaySetAddressDDRAM(0x40);
-	displayWriteDataArray("  BYE   ");
+	displaySetOn(1);//display is off if OFF signal wakes up from parking
+	displayBufferSetPosition(0,0);
+	displayBufferWriteDataArray("  GOOD  ");
+	displayBufferSetPosition(1,0);
+	displayBufferWriteDataArray("  BYE   ");
+	displayFlush();
+	displayQueueWait();//interrupts are disabled -> queue is sent from here
 	
 	while(1){};
 	//wait to power down
@@ -564,43 +1500,66 @@ int main(void)
 	//port C is only input port
 	DDRC = 0x00;
 	PORTC = 0xCB; //pull-up for btn 1-2, reset and unused pin,
-		
+	
+#if ISR_STATS
+	//boot time - timer 2 from here to start of timer 1 (startup code before main() is not measured)
+	//CS22 CS21 CS20
+	TCCR2 = 0x05;//prescaler = 128 (1 tick = 16us)
+#endif
+	
 	clearBit(OUTPUT,SF); //FAN is OFF
 	
 	/*-----------------------
-	Restore data from eeprom
+	Restore data - from session in RAM after reset without power-on (warm boot), else from eeprom
 	------------------------*/	
-	totalDistance = eeprom_read_dword((uint32_t*)15);
-	totalConsumedCapacity = eeprom_read_dword((uint32_t*)25);
-	LineMode = eeprom_read_byte((uint8_t*)35);
+	//- - - - WDRF BORF EXTRF PORF
+	unsigned char warmBoot = !readBit(MCUCSR,PORF) && sessionRestore();
+	MCUCSR = 0;
 	
+	if (!warmBoot)
+	{
+#if EEPROM_MIGRATE
+		eepromMigrate();
+#endif
+		totalDistance = eeprom_read_dword((uint32_t*)15);
+		totalConsumedCapacity = eeprom_read_dword((uint32_t*)25);
+		LineMode = eeprom_read_byte((uint8_t*)35);
+		consumedCapacityFraction = eeprom_read_word((uint16_t*)36);
+		if (consumedCapacityFraction >= CAPACITY_UNIT) consumedCapacityFraction = 0;//empty eeprom
+	}
 	
-	/*-------------------------------------------------------------
-	TIMER1 configuration 
-	generate of "servo" control PWM (1-2ms impulse, 20ms period)
-	--------------------------------------------------------------*/
-	//COM1A1 COM1A0 COM1B1 COM1B0 FOC1A FOC1B WGM11 WGM10
-	TCCR1A = 0x00; //Normal port operation, OC1A/OC1B disconnected, normal mode
+	//total consumed capacity mAh -> Ah (only once)
+	totalConsumedAh = totalConsumedCapacity / 1000;
+	totalConsumedAhFraction = totalConsumedCapacity % 1000;
 	
-	//ICNC1 ICES1  WGM13 WGM12 CS12 CS11 CS10
-	TCCR1B = 0x0B; //CTC mode, prescaler = 64 (250 clk = 2ms, 2500 = 20ms)
+	//total distance cycles -> meters (only once, no overflow: cycles/1000*377)
+	unsigned long meters = (totalDistance / 1000) * WHEEL_CIRCUMFERENCE;
+	unsigned long rest = (totalDistance % 1000) * WHEEL_CIRCUMFERENCE;
+	meters += rest / 1000;
+	totalDistanceFraction = rest % 1000;
+	displayULongToDigits(meters, totalDistanceMeters);
+	snapshotPublish();
 	
-	//compare register A - period 20ms
-	OCR1A = 0x09C4;
 	
-	// compare register B - impulse 1-2ms (OCR1AL=0x7F-0xFF)
-	OCR1B = 0x007F;//1ms
+	servoStart();
 	
+#if ISR_STATS
+	//TOV2 - over 256 ticks
+	statBoot = readBit(TIFR,6) ? 0xFFFF : TCNT2 * STAT_BOOT_TICK;
+	statBootWarm = warmBoot;
+	TCCR2 = 0;//timer 2 stopped
+#endif
+	
+#if DISPLAY_ASYNC
 	/*-------------------------------------------------------------
-	TIMER2 configuration 
-	generate time for speed measuring - period 2ms
+	TIMER0 configuration 
+	display queue tick - period 50us, interrupt is enabled by display.h
 	-------------------------------------------------------------*/
 	
-	//compare register - 2ms period
-	OCR2 = 250;
-	
-	//FOC2 WGM20 COM21 COM20 WGM21 CS22 CS21 CS20
-	TCCR2 = 0x0C;//TCT mode, OC2 disconnected, prescaler = 64	
+	//CS02 CS01 CS00
+	TCCR0 = 0x02;//prescaler = 8 (1 clk = 1us)
+	TCNT0 = 256 - DISPLAY_QUEUE_TICK;
+#endif
 	
 	/*-------------------------------------------------------------
 	external interrupt configuration 
@@ -617,43 +1576,55 @@ int main(void)
 	setBit(GICR,6);		
 		
 	//OCIE2 TOIE2 TICIE1 OCIE1A OCIE1B TOIE1  TOIE0
-	TIMSK = 0x98; //interrupts on compare match
+#if SERVO_HW_PWM
+	TIMSK = 0x0C; //interrupts on compare match 1B and overflow 1
+#else
+	TIMSK = 0x18; //interrupts on compare match 1A, 1B
+#endif
+	
+	adcStart();
 	
 	sei();//global interrupt enable	
 	
 	// display initialization
+	// warm boot - display is powered (no power-on wait), all characters are rewritten by first flush (no clear)
 
 	displayPortsInit(); 
-	_delay_ms(2);	
-	displayFunctionSet(1,1,0);
+	if (!warmBoot) _delay_ms(DISPLAY_POWER_ON_DELAY);	
+	displayFunctionSet(!DISPLAY_4BIT,1,0);
 	displayOnOffControl(1,0,0);
-	displayClear();	
+	if (!warmBoot) displayClear();	
 	
 	displayEntryModeSet(1,0);
 	displayCursorShift(0,1);	
 	
 	
-	//show text for 2 seconds
-	displayPausedCounter = 100;
-	displayPaused = 1;
+	if (!warmBoot)
+	{
+		//show text for 2 seconds
+		taskDelay(TASK_DISPLAY,100);
+		
+		displayBufferSetPosition(0,0);	
+		displayBufferWriteDataArray(" HELLO  ");
+		displayBufferSetPosition(1,0);	
+		displayBufferWriteDataArray("ver. 2.1");
+		displayFlush();
+	}
 	
-	displaySetAddressDDRAM(0x00);	
-	displayWriteDataArray(" HELLO  ");
-	displaySetAddressDDRAM(0x40);	
-	displayWriteDataArray("ver. 2.1");
-			
     while(1)
     {       
-		_delay_ms(7);
-		checkButton();
-		displayRedraw();
+		schedulerRun();
 		
-		//pause redrawing for 0.5s
-		if (displayPaused == 0)
-		{
-			displayPausedCounter = 25;
-			displayPaused = 1;	
-		}
-				
+#if PARKING_TIMEOUT
+		if (parkingSeconds >= PARKING_TIMEOUT) parkingSleep();
+#endif
+		
+#if ADC_NOISE_REDUCTION && IDLE_SLEEP
+		if (!adcSleepConversion()) idleSleep();//conversion is not possible until next interrupt
+#elif ADC_NOISE_REDUCTION
+		adcSleepConversion();
+#elif IDLE_SLEEP
+		idleSleep();
+#endif
     }
 }
\ No newline at end of file
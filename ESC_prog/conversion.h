@@ -0,0 +1,102 @@
+#ifndef CONVERSION_H
+#define CONVERSION_H
+
+/**
+ * Conversion of measured values (ADC results) to regulator inputs.
+ * Without other AVR dependencies - it can be compiled on host.
+ */
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM
+#define pgm_read_byte(address) (*(const unsigned char *)(address))
+#endif
+
+/**
+ * Curve of acceleration handle (tabA).
+ */
+#define THROTTLE_LINEAR 0		//linear
+#define THROTTLE_MEDIUM 1		//mildly progressive
+#define THROTTLE_PROGRESSIVE 2	//fine control at low current
+
+#ifndef THROTTLE_CURVE
+#define THROTTLE_CURVE THROTTLE_MEDIUM
+#endif
+
+/**
+ * Conversion tables. tabA - acceleration handle (51-244) to wanted current,
+ * tabI - current sensor (33-141) to current 0-255 (255 = 50A).
+ */
+#if THROTTLE_CURVE == THROTTLE_LINEAR
+const unsigned char tabA[194] PROGMEM = {0,2,3,4,6,7,8,10,11,12,14,15,16,18,19,20,22,23,24,26,27,28,30,31,32,34,35,36,37,39,40,41,43,44,45,47,48,49,51,52,53,55,56,57,59,60,61,63,64,65,67,68,69,71,72,73,74,76,77,78,80,81,82,84,85,86,88,89,90,92,93,94,96,97,98,100,101,102,104,105,106,108,109,110,111,113,114,115,117,118,119,121,122,123,125,126,127,129,130,131,133,134,135,137,138,139,141,142,143,144,146,147,148,150,151,152,154,155,156,158,159,160,162,163,164,166,167,168,170,171,172,174,175,176,178,179,180,181,183,184,185,187,188,189,191,192,193,195,196,197,199,200,201,203,204,205,207,208,209,211,212,213,215,216,217,218,220,221,222,224,225,226,228,229,230,232,233,234,236,237,238,240,241,242,244,245,246,248,249,250,251,253,254,255};
+#elif THROTTLE_CURVE == THROTTLE_PROGRESSIVE
+const unsigned char tabA[194] PROGMEM = {0,0,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,2,2,2,2,2,2,2,2,2,3,3,3,3,3,3,4,4,4,4,5,5,5,5,6,6,6,6,7,7,7,8,8,9,9,9,10,10,11,11,12,12,13,13,14,14,15,16,16,17,17,18,19,20,20,21,22,23,24,24,25,26,27,28,29,30,31,32,33,34,35,36,38,39,40,41,43,44,45,47,48,49,51,52,54,55,57,58,60,62,63,65,67,69,71,72,74,76,78,80,82,84,86,89,91,93,95,97,100,102,104,107,109,112,114,117,119,122,125,127,130,133,136,139,141,144,147,150,153,156,160,163,166,169,172,176,179,182,186,189,192,196,199,203,206,210,214,217,221,225,228,232,236,240,244,248,252,255};
+#else
+const unsigned char tabA[194] PROGMEM = {0,1,1,1,1,1,2,2,2,2,3,3,3,4,4,4,5,5,6,6,7,7,8,8,9,9,10,11,11,12,12,13,14,15,15,16,17,18,18,19,20,21,22,23,24,24,25,26,27,28,29,30,31,32,33,34,36,37,38,39,40,41,42,44,45,46,47,48,50,51,52,53,55,56,57,59,60,61,63,64,65,67,68,70,71,72,74,75,77,78,80,81,83,84,86,87,89,90,92,93,95,96,98,99,101,103,104,106,107,109,111,112,114,115,117,119,120,122,124,125,127,128,130,132,133,135,137,138,140,142,143,145,147,149,150,152,154,155,157,159,160,162,164,165,167,169,171,172,174,176,177,179,181,183,184,186,188,190,191,193,195,197,198,200,202,204,205,207,209,211,213,214,216,218,220,222,223,225,227,229,231,233,234,236,238,240,242,244,246,248,250,252,254,255};
+#endif
+const unsigned char tabI[109] PROGMEM = {0,3,5,8,10,12,15,17,19,22,24,26,29,31,34,36,38,41,43,45,48,50,52,55,57,59,62,64,67,69,71,74,76,78,81,83,85,88,90,93,95,97,100,102,104,107,109,111,114,116,118,121,123,126,128,130,133,135,137,140,142,144,147,149,152,154,156,159,161,163,166,168,170,173,175,177,180,182,185,187,189,192,194,196,199,201,203,206,208,211,213,215,218,220,222,225,227,229,232,234,236,239,241,244,246,248,251,253,255};
+//const unsigned char tabU[147] PROGMEM = {0,2,4,6,7,9,11,13,14,16,18,20,21,23,25,27,28,30,32,34,35,37,39,41,42,44,46,47,49,51,53,54,56,58,60,61,63,65,67,68,70,72,74,75,77,79,81,82,84,86,87,89,91,93,94,96,98,100,101,103,105,107,108,110,112,114,115,117,119,121,122,124,126,128,129,131,133,134,136,138,140,141,143,145,147,148,150,152,154,155,157,159,161,162,164,166,168,169,171,173,174,176,178,180,181,183,185,187,188,190,192,194,195,197,199,201,202,204,206,208,209,211,213,215,216,218,220,221,223,225,227,228,230,232,234,235,237,239,241,242,244,246,248,249,251,253,255};
+
+/**
+ * Limits measured value to range and moves it to 0.
+ * @param measured 8b ADC result, 255 = 4.7V
+ * @param min value converted to 0
+ * @param max maximal value
+ * @return 0 - (max - min)
+ */
+static inline unsigned char convertRange(unsigned char measured, unsigned char min, unsigned char max)
+{
+	if (measured < min)
+	{
+		return 0;
+	}
+	else if (measured > max)
+	{
+		return (max-min);
+	}
+	else
+	{
+		return (measured - min);
+	}
+}
+
+/**
+ * Wanted current from acceleration handle, min 0.86V = 51, max 4.5V = 244.
+ * @param measured 8b ADC result
+ * @return wanted current 0-255
+ */
+static inline unsigned char convertAcceleration(unsigned char measured)
+{
+	return pgm_read_byte(&tabA[convertRange(measured, 51, 244)]);
+}
+
+/**
+ * Current from 12b oversampled value, 0A = 0.6V, 50A = 2.6V.
+ * tabI is interpolated by 4 lower bits.
+ * @param measured 12b value, 16 = 1 step of 8b ADC
+ * @return current 0-255 (255 = 50A)
+ */
+static inline unsigned char convertCurrent(unsigned int measured)
+{
+	unsigned char index;
+	unsigned char low;
+	unsigned char high;
+
+	if (measured < (33 << 4))//0A - 0.6V
+	{
+		return 0;
+	}
+	measured -= (33 << 4);
+	if (measured >= ((141 - 33) << 4))//50A - 2.6V
+	{
+		return pgm_read_byte(&tabI[141 - 33]);
+	}
+
+	index = measured >> 4;
+	low = pgm_read_byte(&tabI[index]);
+	high = pgm_read_byte(&tabI[index + 1]);
+
+	return low + (((high - low) * (measured & 0x0F)) >> 4);
+}
+
+#endif
@@ -5,13 +5,33 @@
 
 #define F_CPU 8000000UL
 #include <util/delay.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+/**
+ * Interface mode. DISPLAY_4BIT 0: DB0-DB7 on PB0-PB7, DISPLAY_4BIT 1: DB4-DB7
+ * on PB4-PB7 and PB0-PB3 are free (e.g. for OC1A/OC1B). In 4-bit mode DISPLAY_PORT
+ * is a RAM byte and DISPLAY_PULSE() sends it as two nibbles.
+ */
+#ifndef DISPLAY_4BIT
+#define DISPLAY_4BIT 0
+#endif
 
 /**
  * Ports definition.
  */
-#define DISPLAY_PORT PORTB
+#define DISPLAY_BUS_PORT PORTB
 #define DISPLAY_DDR DDRB
-#define DISPLAY_PIN PIND
+#define DISPLAY_PIN PINB
+
+#if DISPLAY_4BIT
+#define DISPLAY_BUS_MASK 0xF0
+unsigned char displayData = 0;
+#define DISPLAY_PORT displayData
+#else
+#define DISPLAY_BUS_MASK 0xFF
+#define DISPLAY_PORT DISPLAY_BUS_PORT
+#endif
 
 #define E_PORT PORTD
 #define E_DDR DDRD
@@ -37,23 +57,151 @@
 #define SET_RS() (setBit((RS_PORT),(RS_BIT)))
 #define CLEAR_RS() (clearBit((RS_PORT),(RS_BIT)))
 
+#define DISPLAY_BUS_KEEP ((unsigned char)~DISPLAY_BUS_MASK)	// port bits not used by display
+
+#define DISPLAY_BUS_INPUT() (DISPLAY_DDR &= DISPLAY_BUS_KEEP)
+#define DISPLAY_BUS_OUTPUT() (DISPLAY_DDR |= DISPLAY_BUS_MASK)
+
+#if DISPLAY_4BIT
+
+/**
+ * Puts upper nibble of data on DB4-DB7 and generates 1us pulse at E_PORT. 
+ */
+#define DISPLAY_NIBBLE(data) DISPLAY_BUS_PORT = (DISPLAY_BUS_PORT & DISPLAY_BUS_KEEP) | ((data) & DISPLAY_BUS_MASK); SET_E(); _delay_us(1); CLEAR_E(); _delay_us(1);
+
+/**
+ * Sends DISPLAY_PORT as two nibbles. 
+ */
+#define DISPLAY_PULSE() DISPLAY_NIBBLE(displayData); DISPLAY_NIBBLE(displayData << 4);
+
+#else
+
+/**
+ * Generates 1us pulse at E_PORT, data are already on DISPLAY_PORT. 
+ */
+#define DISPLAY_PULSE() SET_E(); _delay_us(1); CLEAR_E();
+
+#endif
+
+/**
+ * Reads byte from data bus, RS and R/W must be set before. 
+ * In 4-bit mode reads two nibbles.
+ *
+ * @return data
+ */
+unsigned char displayBusRead(void){
+	unsigned char data;
+	
+	DISPLAY_BUS_INPUT();
+	SET_E();
+	_delay_us(1);
+	data = DISPLAY_PIN;
+	CLEAR_E();
+#if DISPLAY_4BIT
+	data &= DISPLAY_BUS_MASK;
+	_delay_us(1);
+	SET_E();
+	_delay_us(1);
+	data |= (DISPLAY_PIN >> 4);
+	CLEAR_E();
+#endif
+	DISPLAY_BUS_OUTPUT();
+	return data;
+}
+
 /**
- * Generates 5us pulse at E_PORT and waits 35us for display to finish command (function lasts cca 40us). 
+ * Busy flag mode. If DISPLAY_BUSY_FLAG is 1, every command polls the busy flag
+ * (DB7) and returns as soon as display is ready. If display does not answer in
+ * DISPLAY_BUSY_TIMEOUT polls (cca 3ms), the command falls back to fixed delay. 
+ * With DISPLAY_ASYNC 1 the polling commands run only in initialization (function
+ * set, on/off, clear, entry mode, cursor shift) - displayFlush() and displaySetOn()
+ * go through the queue, which uses one busy flag read per tick (displayReadBusy()).
  */
-#define DISPLAY_EXECUTE() SET_E(); _delay_us(5); CLEAR_E(); _delay_us(35);
+#ifndef DISPLAY_BUSY_FLAG
+#define DISPLAY_BUSY_FLAG 1
+#endif
+
+#define DISPLAY_BUSY_TIMEOUT 1000
+#define DISPLAY_BF_BIT 7
 
 /**
- * Generates 5us pulse at E_PORT and waits 1.59ms for display
- * to finish command (function lasts cca 1.64ms). 
+ * Power-on time of display (ms) before first command and busy flag poll.
+ */
+#define DISPLAY_POWER_ON_DELAY 40
+
+/**
+ * Waits until busy flag is cleared. RS and R/W are restored before return.
+ *
+ * @return 0 - display is ready, 1 - busy flag is not answered (use fixed delay for this command)
  */
-#define DISPLAY_EXECUTE2() SET_E();	_delay_us(5); CLEAR_E(); _delay_ms(2);	//_delay_ms(1.59);							
+unsigned char displayWaitBusy(void){
+	unsigned int timeout = DISPLAY_BUSY_TIMEOUT;
+	unsigned char rs = readBit(RS_PORT, RS_BIT);
+	unsigned char busy;
+	
+	CLEAR_RS();
+	SET_RW();
+	do{
+		busy = readBit(displayBusRead(), DISPLAY_BF_BIT);
+		timeout--;
+	} while(busy && timeout);
+	CLEAR_RW();
+	if(rs) SET_RS();
+	
+	return busy;
+}
+
+/**
+ * Reads busy flag once (no waiting). RS and R/W are left cleared.
+ *
+ * @return 1 - display is busy
+ */
+unsigned char displayReadBusy(void){
+	unsigned char busy;
+	
+	CLEAR_RS();
+	SET_RW();
+	busy = readBit(displayBusRead(), DISPLAY_BF_BIT);
+	CLEAR_RW();
+	return busy;
+}
+
+#if DISPLAY_BUSY_FLAG
+
+/**
+ * Sends data and waits for busy flag (cca 40us, or less
+ * if display is faster). Falls back to 35us delay. 
+ */
+#define DISPLAY_EXECUTE() DISPLAY_PULSE(); if(displayWaitBusy()) _delay_us(35);
+
+/**
+ * Sends data and waits for busy flag (cca 1.52ms).
+ * Falls back to 2ms delay. 
+ */
+#define DISPLAY_EXECUTE2() DISPLAY_PULSE(); if(displayWaitBusy()) _delay_ms(2);
+
+#else
+
+/**
+ * Sends data and waits 39us for display to finish command (function lasts cca 40us). 
+ */
+#define DISPLAY_EXECUTE() DISPLAY_PULSE(); _delay_us(39);
+
+/**
+ * Sends data and waits 2ms for display
+ * to finish command (function lasts cca 2ms). 
+ */
+#define DISPLAY_EXECUTE2() DISPLAY_PULSE(); _delay_ms(2);	//_delay_ms(1.59);							
+
+#endif
 
 /**
  * Initializes display ports.
  */
 void displayPortsInit(void){
 	DISPLAY_PORT = 0;
-	DISPLAY_DDR = 0xFF;
+	DISPLAY_BUS_PORT &= DISPLAY_BUS_KEEP;
+	DISPLAY_BUS_OUTPUT();
 	setBit(E_DDR, E_BIT);
 	setBit(RW_DDR, RW_BIT);
 	setBit(RS_DDR, RS_BIT);
@@ -164,6 +312,17 @@ void displayCursorShift(unsigned char SC, unsigned char RL){
 void displayFunctionSet(unsigned char DL, unsigned char N, unsigned char F){
 	CLEAR_RW();
 	CLEAR_RS();
+#if DISPLAY_4BIT
+	//display can be in 8-bit or 4-bit mode -> 3x 8-bit function set, then 4-bit by one nibble
+	DISPLAY_NIBBLE(0b00110000);
+	_delay_ms(5);
+	DISPLAY_NIBBLE(0b00110000);
+	_delay_us(100);
+	DISPLAY_NIBBLE(0b00110000);
+	_delay_us(40);
+	DISPLAY_NIBBLE(0b00100000);
+	_delay_us(40);
+#endif
 	DISPLAY_PORT = 0b00100000;
 	if(DL) setBit(DISPLAY_PORT, 4);
 	if(N) setBit(DISPLAY_PORT, 3);
@@ -213,12 +372,8 @@ void displaySetAddressDDRAM(unsigned char address){
 unsigned char displayBussyFlagAddressRead(void){
 	SET_RW();
 	CLEAR_RS();
-	DISPLAY_DDR = 0x00;
-	SET_E();
-	_delay_us(5);
-	unsigned char data = DISPLAY_PIN;
-	CLEAR_E();
-	DISPLAY_DDR = 0xFF;
+	unsigned char data = displayBusRead();
+	CLEAR_RW();
 	return data;
 }
 
@@ -248,12 +403,8 @@ void displayWriteData(unsigned char data){
 unsigned char displayReadData(void){
 	SET_RW();
 	SET_RS();
-	DISPLAY_DDR = 0x00;
-	SET_E();
-	_delay_us(5);
-	unsigned char data = DISPLAY_PIN;
-	CLEAR_E();
-	DISPLAY_DDR = 0xFF;
+	unsigned char data = displayBusRead();
+	CLEAR_RW();
 	return data;
 }
 
@@ -271,4 +422,338 @@ void displayWriteDataArray(char* data){
 	}
 }
 
+/**
+ * Asynchronous mode. If DISPLAY_ASYNC is 1, displayFlush() only puts RS-tagged
+ * bytes into a ring buffer and displayQueueTick() (called from timer 0 overflow
+ * every DISPLAY_QUEUE_TICK us) sends one byte per tick. Tick is longer than
+ * nominal command execution time (37us), a slower display (e.g. low oscillator
+ * frequency) is checked by one busy flag read per tick - busy tick is skipped,
+ * after DISPLAY_QUEUE_BUSY_MAX busy ticks the byte is sent anyway (display without
+ * busy flag). Timer 0 interrupt is enabled only while queue is not empty.
+ */
+#ifndef DISPLAY_ASYNC
+#define DISPLAY_ASYNC 1
+#endif
+
+#define DISPLAY_QUEUE_SIZE 32	// must be power of 2
+#define DISPLAY_QUEUE_TICK 50	// us, timer 0 prescaler 8 -> 1 count = 1us
+#define DISPLAY_QUEUE_HOLD 40	// ticks to wait after clear / home command (2ms)
+#define DISPLAY_QUEUE_BUSY_MAX 40	// max. busy ticks before next byte (2ms)
+
+unsigned char displayQueueData[DISPLAY_QUEUE_SIZE];
+unsigned char displayQueueRS[DISPLAY_QUEUE_SIZE];
+volatile unsigned char displayQueueHead = 0;	// next free position
+volatile unsigned char displayQueueTail = 0;	// next byte to send
+volatile unsigned char displayQueueHold = 0;	// ticks to wait, 0 = next byte can be sent
+unsigned char displayQueueBusy = 0;				// busy ticks before next byte
+
+/**
+ * Sends one byte from queue, if display is ready. 
+ * Disables timer 0 interrupt when queue is empty.
+ * Must be called with interrupts disabled (from ISR).
+ */
+void displayQueueTick(void){
+	unsigned char tail = displayQueueTail;
+	unsigned char data;
+	
+	if(displayQueueHold){
+		displayQueueHold--;
+		return;
+	}
+	if(tail == displayQueueHead){
+		clearBit(TIMSK, TOIE0);
+		return;
+	}
+#if DISPLAY_BUSY_FLAG
+	if(displayReadBusy() && displayQueueBusy < DISPLAY_QUEUE_BUSY_MAX){
+		displayQueueBusy++;
+		return;
+	}
+	displayQueueBusy = 0;
+#endif
+	
+	data = displayQueueData[tail];
+	CLEAR_RW();
+	if(displayQueueRS[tail]){
+		SET_RS();
+	}
+	else{
+		CLEAR_RS();
+		if(data < 4) displayQueueHold = DISPLAY_QUEUE_HOLD;	// clear or home command
+	}
+	DISPLAY_PORT = data;
+	DISPLAY_PULSE();
+	displayQueueTail = (tail + 1) & (DISPLAY_QUEUE_SIZE - 1);
+}
+
+/**
+ * Waits until queue is empty. If interrupts are disabled (INT1 power off path),
+ * queue is sent from here.
+ */
+void displayQueueWait(void){
+	while(displayQueueHead != displayQueueTail || displayQueueHold){
+		if(!readBit(SREG, 7)){
+			displayQueueTick();
+			_delay_us(DISPLAY_QUEUE_TICK);
+		}
+	}
+}
+
+/**
+ * Puts byte into queue and starts timer 0 interrupt. Returns immediately,
+ * waits only if queue is full.
+ *
+ * @param rs 0 - command, 1 - data
+ * @param data byte to send
+ */
+void displayQueuePut(unsigned char rs, unsigned char data){
+	unsigned char head = displayQueueHead;
+	unsigned char next = (head + 1) & (DISPLAY_QUEUE_SIZE - 1);
+	unsigned char sreg;
+	
+	while(next == displayQueueTail){	// queue is full
+		if(!readBit(SREG, 7)){
+			displayQueueTick();
+			_delay_us(DISPLAY_QUEUE_TICK);
+		}
+	}
+	displayQueueData[head] = data;
+	displayQueueRS[head] = rs;
+	displayQueueHead = next;
+	
+	sreg = SREG;
+	cli();
+	setBit(TIMSK, TOIE0);
+	SREG = sreg;
+}
+
+/**
+ * Shadow framebuffer. Text is composed into displayBuffer and displayFlush()
+ * sends only the cells which differ from displayShadow (copy of DDRAM).
+ * Line n starts at DDRAM address n * 0x40.
+ */
+#ifndef DISPLAY_LINES
+#define DISPLAY_LINES 2
+#endif
+
+#ifndef DISPLAY_COLS
+#define DISPLAY_COLS 8
+#endif
+
+char displayBuffer[DISPLAY_LINES][DISPLAY_COLS];	// wanted content
+char displayShadow[DISPLAY_LINES][DISPLAY_COLS];	// content of DDRAM, 0 = unknown
+unsigned char displayBufferLine = 0;
+unsigned char displayBufferCol = 0;
+
+/**
+ * Marks whole display as unknown, next displayFlush() rewrites all cells.
+ * Call it after writing to display directly.
+ */
+void displayBufferInvalidate(void){
+	for(unsigned char line = 0; line < DISPLAY_LINES; line++){
+		for(unsigned char col = 0; col < DISPLAY_COLS; col++){
+			displayShadow[line][col] = 0;
+		}
+	}
+}
+
+/**
+ * Sets position of next character written into buffer.
+ *
+ * @param line display line
+ * @param col column in line
+ */
+void displayBufferSetPosition(unsigned char line, unsigned char col){
+	displayBufferLine = line;
+	displayBufferCol = col;
+}
+
+/**
+ * Writes character into buffer, characters behind end of line are dropped.
+ *
+ * @param data character to write
+ */
+void displayBufferWriteData(char data){
+	if(displayBufferCol < DISPLAY_COLS){
+		displayBuffer[displayBufferLine][displayBufferCol] = data;
+		displayBufferCol++;
+	}
+}
+
+/**
+ * Writes char array into buffer.
+ *
+ * @param char array
+ */
+void displayBufferWriteDataArray(char* data){
+	for(int i = 0; data[i] != '\0'; i++){
+		displayBufferWriteData(data[i]);
+	}
+}
+
+/**
+ * Fills rest of actual buffer line with spaces.
+ */
+void displayBufferClearLine(void){
+	while(displayBufferCol < DISPLAY_COLS){
+		displayBufferWriteData(' ');
+	}
+}
+
+/**
+ * Number formatting into buffer. Digits are computed by subtracting powers
+ * of ten (no division, ATmega8 has no hardware divider).
+ */
+#define DISPLAY_NUMBER_DIGITS 10	// digits of unsigned long
+
+const unsigned long displayPow10[DISPLAY_NUMBER_DIGITS] PROGMEM = {1000000000,100000000,10000000,1000000,100000,10000,1000,100,10,1};
+const unsigned int displayPow10Int[5] PROGMEM = {10000,1000,100,10,1};
+
+/**
+ * Writes decimal digits into buffer, leading zeros are skipped.
+ *
+ * @param digits decimal digits, most significant first
+ * @param count count of digits to write (from most significant)
+ * @param width minimal count of characters, number is right aligned by spaces
+ * @param point count of digits behind decimal point (0 = integer)
+ */
+void displayBufferWriteDigits(unsigned char* digits, unsigned char count, unsigned char width, unsigned char point){
+	unsigned char first = 0;
+	unsigned char length;
+	
+	while(first < count - 1 - point && digits[first] == 0) first++;
+	
+	length = count - first;
+	if(point) length++;
+	for(; width > length; width--){
+		displayBufferWriteData(' ');
+	}
+	
+	for(; first < count; first++){
+		if(point && first == count - point) displayBufferWriteData('.');
+		displayBufferWriteData('0' + digits[first]);
+	}
+}
+
+/**
+ * Converts 32b number into DISPLAY_NUMBER_DIGITS decimal digits.
+ *
+ * @param number value
+ * @param digits output, most significant first
+ */
+void displayULongToDigits(unsigned long number, unsigned char* digits){
+	for(unsigned char i = 0; i < DISPLAY_NUMBER_DIGITS; i++){
+		unsigned long power = pgm_read_dword(&displayPow10[i]);
+		unsigned char digit = 0;
+		while(number >= power){
+			number -= power;
+			digit++;
+		}
+		digits[i] = digit;
+	}
+}
+
+/**
+ * Writes 32b number into buffer.
+ *
+ * @param number value (fixed point: 124 with point 1 = "12.4")
+ * @param width minimal count of characters, number is right aligned by spaces
+ * @param point count of digits behind decimal point (0 = integer)
+ */
+void displayBufferWriteULong(unsigned long number, unsigned char width, unsigned char point){
+	unsigned char digits[DISPLAY_NUMBER_DIGITS];
+	
+	displayULongToDigits(number, digits);
+	displayBufferWriteDigits(digits, DISPLAY_NUMBER_DIGITS, width, point);
+}
+
+/**
+ * Writes 16b number into buffer, only 16b subtraction is used.
+ *
+ * @param number value (fixed point: 124 with point 1 = "12.4")
+ * @param width minimal count of characters, number is right aligned by spaces
+ * @param point count of digits behind decimal point (0 = integer)
+ */
+void displayBufferWriteUInt(unsigned int number, unsigned char width, unsigned char point){
+	unsigned char digits[DISPLAY_NUMBER_DIGITS] = {0,0,0,0,0};
+	
+	for(unsigned char i = 0; i < 5; i++){
+		unsigned int power = pgm_read_word(&displayPow10Int[i]);
+		unsigned char digit = 0;
+		while(number >= power){
+			number -= power;
+			digit++;
+		}
+		digits[DISPLAY_NUMBER_DIGITS - 5 + i] = digit;
+	}
+	displayBufferWriteDigits(digits, DISPLAY_NUMBER_DIGITS, width, point);
+}
+
+/**
+ * Writes 8b number into buffer, only 8b subtraction is used.
+ *
+ * @param number value (fixed point: 124 with point 1 = "12.4")
+ * @param width minimal count of characters, number is right aligned by spaces
+ * @param point count of digits behind decimal point (0 = integer)
+ */
+void displayBufferWriteUChar(unsigned char number, unsigned char width, unsigned char point){
+	unsigned char digits[DISPLAY_NUMBER_DIGITS] = {0,0,0,0,0,0,0,0,0,0};
+	
+	while(number >= 100){
+		number -= 100;
+		digits[DISPLAY_NUMBER_DIGITS - 3]++;
+	}
+	while(number >= 10){
+		number -= 10;
+		digits[DISPLAY_NUMBER_DIGITS - 2]++;
+	}
+	digits[DISPLAY_NUMBER_DIGITS - 1] = number;
+	displayBufferWriteDigits(digits, DISPLAY_NUMBER_DIGITS, width, point);
+}
+
+/**
+ * Sends changed cells to display (or to queue in asynchronous mode).
+ * DDRAM address is set only if changed cell does not follow previous written cell.
+ */
+void displayFlush(void){
+	unsigned char address = 0xFF;	// actual address counter, 0xFF = unknown
+	
+	for(unsigned char line = 0; line < DISPLAY_LINES; line++){
+		for(unsigned char col = 0; col < DISPLAY_COLS; col++){
+			char data = displayBuffer[line][col];
+			if(displayShadow[line][col] != data){
+				if(address != line * 0x40 + col){
+					address = line * 0x40 + col;
+#if DISPLAY_ASYNC
+					displayQueuePut(0, 0b10000000 | address);
+#else
+					displaySetAddressDDRAM(address);
+#endif
+				}
+#if DISPLAY_ASYNC
+				displayQueuePut(1, data);
+#else
+				displayWriteData(data);
+#endif
+				displayShadow[line][col] = data;
+				address++;
+			}
+		}
+	}
+}
+
+/**
+ * Switches display on or off without re-initialization, DDRAM content is kept.
+ * Cursor and blink are off.
+ *
+ * @param on 1 - display on, 0 - display off (blank)
+ */
+void displaySetOn(unsigned char on){
+#if DISPLAY_ASYNC
+	displayQueuePut(0, on ? 0b00001100 : 0b00001000);
+#else
+	displayOnOffControl(on, 0, 0);
+#endif
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,176 @@
+#ifndef REGULATOR_H
+#define REGULATOR_H
+
+#include <stdint.h>
+
+/**
+ * PII current regulator. Input is wanted current and measured current
+ * (0-255, 255 = 50A), output is wantedSpeed for the ESC (0-1023).
+ * Without AVR dependencies - it can be compiled on host.
+ *
+ * Output and integrator are signed Q4 (16 = 1 step of output), all products
+ * are 8b x 8b / 16b x 8b for hardware MUL and sums are saturated in 32b.
+ *
+ * u  = KP * e + I
+ * I  = I + KI * e + ((KII * E) >> REG_KII_SHIFT)	(E = E + e, double integrator)
+ *
+ * Regulator is called every frame, gains are per 20ms in all ESC_PROTOCOLs -
+ * with REG_FRAMES calls per 20ms the increments of E and I are divided by
+ * REG_FRAMES (remainder is kept in 32b residuals, nothing is lost).
+ * State is int16_t - same width on host (simulators) and AVR.
+ *
+ * Worst-case cycle count of regulator() is not given here - there is no
+ * -Os listing or device measurement of it yet. REG_FRAMES > 1 adds two
+ * 32b multiplications (regStep) per call. Measure with ISR_STATS=1: max.
+ * of CmB page (TIMER1_COMPB_vect in timer 1 ticks, 8 CPU cycles per us)
+ * minus the same build without the regulator() call.
+ */
+#ifndef REG_FRAMES
+#define REG_FRAMES 1		//regulator calls per 20ms (FRAMES_PER_20MS)
+#endif
+#ifndef REG_KP
+#define REG_KP 0			//proportional gain, Q4 output per current step (0-127)
+#endif
+#ifndef REG_KI
+#define REG_KI 1			//integral gain, Q4 output per current step and 20ms (0-127)
+#endif
+#ifndef REG_KII
+#define REG_KII 1			//double integral gain (0-127), 0 = PI regulator
+#endif
+#ifndef REG_KII_SHIFT
+#define REG_KII_SHIFT 6		//KII * E >> REG_KII_SHIFT
+#endif
+#ifndef REG_LINEAR_MAX
+#define REG_LINEAR_MAX 768	//current linearization factor at output 0, 256 = 1 (512-1024)
+#endif
+#ifndef REG_LINEAR_SHIFT
+#define REG_LINEAR_SHIFT 1	//factor decrease: output >> REG_LINEAR_SHIFT (1-2)
+#endif
+
+#define REG_Q 4										//fractional bits of output and integrator
+#define REG_OUTPUT_MAX 1023							//max wantedSpeed
+#define REG_INTEGRAL_MAX ((long)REG_OUTPUT_MAX << REG_Q)	//integrator saturation (Q4)
+#define REG_ERROR_MAX 255							//error saturation
+#define REG_ERROR_SUM_MAX (255L << REG_KII_SHIFT)	//double integrator saturation
+#define REG_STEP_SHIFT 13							//increment / REG_FRAMES = increment * REG_STEP_MUL >> REG_STEP_SHIFT
+#define REG_STEP_MUL (((1L << REG_STEP_SHIFT) + REG_FRAMES / 2) / REG_FRAMES)
+
+#if REG_ERROR_SUM_MAX > 32767
+#error "REG_KII_SHIFT > 7 - double integrator does not fit to 16b"
+#endif
+
+/**
+ * Regulator state.
+ */
+int16_t regIntegral = 0;			//I, -REG_INTEGRAL_MAX - REG_INTEGRAL_MAX (Q4), negative while KP * e is above output
+int16_t regErrorSum = 0;			//E, -REG_ERROR_SUM_MAX - REG_ERROR_SUM_MAX
+unsigned int regOutput = 0;		//last output 0-1023
+unsigned char regCurrent0 = 0;	//current offset measured while regulator is off
+unsigned char regActive = 0;	//0 = off, next start is bumpless
+int32_t regErrorResidual = 0;	//part of E increment under 1, 0 - 2^REG_STEP_SHIFT-1 (REG_FRAMES > 1)
+int32_t regIntegralResidual = 0;	//part of I increment under 1 (REG_FRAMES > 1)
+
+/**
+ * Saturates value into range.
+ * @param value value to saturate
+ * @param min minimal value
+ * @param max maximal value
+ * @return value in range min - max
+ */
+static inline long regSaturate(long value, long min, long max)
+{
+	if (value < min) return min;
+	if (value > max) return max;
+	return value;
+}
+
+/**
+ * Divides increment of integrator by REG_FRAMES (per 20ms gain -> per call).
+ * @param residual remainder of previous calls
+ * @param increment increment per 20ms
+ * @return increment per this call
+ */
+static inline long regStep(int32_t *residual, long increment)
+{
+	long step;
+
+	if (REG_FRAMES <= 1) return increment;
+
+	*residual += increment * REG_STEP_MUL;
+	step = *residual >> REG_STEP_SHIFT;
+	*residual &= (1L << REG_STEP_SHIFT) - 1;
+	return step;
+}
+
+/**
+ * Sets regulator off. Output is 0, measured current is taken as offset
+ * (current of the rest of the scooter and zero error of the sensor).
+ * @param actual measured current
+ */
+static inline void regulatorReset(unsigned char actual)
+{
+	regIntegral = 0;
+	regErrorSum = 0;
+	regErrorResidual = 0;
+	regIntegralResidual = 0;
+	regOutput = 0;
+	regCurrent0 = actual;
+	regActive = 0;
+}
+
+/**
+ * One step of regulation, called every frame (REG_FRAMES per 20ms).
+ * Measured current is linearized by output (motor current is higher than
+ * battery current at low speed): real = (actual - current0) * (REG_LINEAR_MAX - (output >> REG_LINEAR_SHIFT)) / 256,
+ * with defaults (3 - 2 * output / 1024).
+ * Anti-windup: integrators stop when output is saturated in direction of error.
+ * Bumpless transfer: at start the integrator is set to output - KP * e (it can be negative),
+ * so output continues from last value (0 after regulatorReset) instead of jumping by KP * e.
+ * @param wanted wanted current 0-255, <= 1 switches regulator off
+ * @param actual measured current 0-255
+ * @return wantedSpeed 0-1023
+ */
+static inline unsigned int regulator(unsigned char wanted, unsigned char actual)
+{
+	int real;		//linearized current above offset, signed
+	int error;		//-255 - 255
+	long proportional;
+	long integral;
+	long output;
+
+	if (wanted <= 1)//no acceleration wanted -> wanted speed = 0
+	{
+		regulatorReset(actual);
+		return 0;
+	}
+
+	//factor in Q5 (max 128), product fits to 16b
+	real = ((int)actual - (int)regCurrent0) * (int)((REG_LINEAR_MAX - (regOutput >> REG_LINEAR_SHIFT)) >> 3);
+	real >>= 5;
+
+	error = regSaturate((int)wanted - real, -REG_ERROR_MAX, REG_ERROR_MAX);
+	proportional = (long)REG_KP * error;
+
+	if (!regActive)//bumpless start
+	{
+		regIntegral = regSaturate(((long)regOutput << REG_Q) - proportional, -REG_INTEGRAL_MAX, REG_INTEGRAL_MAX);
+		regActive = 1;
+	}
+
+	output = proportional + regIntegral;
+
+	//anti-windup - conditional integration
+	if (!((output >= REG_INTEGRAL_MAX && error > 0) || (output <= 0 && error < 0)))
+	{
+		regErrorSum = regSaturate((long)regErrorSum + regStep(&regErrorResidual, error), -REG_ERROR_SUM_MAX, REG_ERROR_SUM_MAX);
+		integral = (long)regIntegral + regStep(&regIntegralResidual,
+			(long)REG_KI * error + (((long)REG_KII * regErrorSum) >> REG_KII_SHIFT));
+		regIntegral = regSaturate(integral, -REG_INTEGRAL_MAX, REG_INTEGRAL_MAX);
+		output = proportional + regIntegral;
+	}
+
+	regOutput = regSaturate(output, 0, REG_INTEGRAL_MAX) >> REG_Q;
+	return regOutput;
+}
+
+#endif
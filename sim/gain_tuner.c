@@ -0,0 +1,394 @@
+/*
+ * gain_tuner.c
+ *
+ * Parameter sweep of regulator gains on the host (Linux). Every candidate
+ * is simulated in closed loop (regulator.h, conversion.h, scooter_model.h)
+ * by all CPU cores (one process per core) and ranked by overshoot,
+ * settling time and energy per km. Best candidate is written as header for
+ * the firmware (build ESC_prog.c with REGULATOR_GAINS=1).
+ *
+ * Build:	gcc -std=gnu99 -O2 -I../ESC_prog -o gain_tuner gain_tuner.c -lm
+ * Run:		./gain_tuner [-n random_count] [-s seed] [-j jobs] [-r frames_per_s] [-m rider_kg]
+ *				[-w overshoot,settling,energy] [-o ../ESC_prog/regulator_gains.h] > ranking.csv
+ *
+ * -n 0 (default) is grid search. Ranking of all candidates is CSV on stdout.
+ * Step response is measured at fixed wheel speeds (test stand) - motor current
+ * settles there, on free ride it keeps changing with speed. REG_KII_SHIFT of
+ * candidates is max. 7 (double integrator must fit to 16b, see regulator.h).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include <sys/wait.h>
+
+//gains of regulator.h as variables
+int regKp;
+int regKi;
+int regKii;
+int regKiiShift;
+int regLinearMax;
+int regLinearShift;
+
+#define REG_KP regKp
+#define REG_KI regKi
+#define REG_KII regKii
+#define REG_KII_SHIFT regKiiShift
+#define REG_LINEAR_MAX regLinearMax
+#define REG_LINEAR_SHIFT regLinearShift
+
+int regFrames = 1;				//regulator calls per 20ms as in firmware (FRAMES_PER_20MS)
+
+#define REG_FRAMES regFrames
+
+#include "conversion.h"
+#include "regulator.h"
+#include "scooter_model.h"
+
+/*----------------------------------
+Candidates
+-----------------------------------*/
+
+#define CANDIDATES_MAX 100000
+#define JOBS_MAX 256
+
+#define STEP_TIME 5.0			//s, step response window
+#define RIDE_TIME 120.0			//s, ride for energy per km: 40s full, 40s half, 40s off
+
+struct candidate
+{
+	int kp;
+	int ki;
+	int kii;
+	int kiiShift;
+	int linearMax;
+	int linearShift;
+};
+
+struct result
+{
+	long index;
+	double overshoot;			//% of final motor current, max of steps
+	double settling;			//s, max of steps
+	double energy;				//Wh/km
+};
+
+struct candidate candidates[CANDIDATES_MAX];
+struct result results[CANDIDATES_MAX];
+long candidateCount = 0;
+
+double frameTime = 0.02;
+double riderMass = 80.0;
+double weightOvershoot = 1.0;
+double weightSettling = 10.0;
+double weightEnergy = 1.0;
+
+const int gridKp[] = {0, 1, 2, 4, 8, 16, 32};
+const int gridKi[] = {1, 2, 3, 4, 6, 8};
+const int gridKii[] = {0, 1, 2, 4};
+const int gridKiiShift[] = {4, 5, 6, 7};
+const int gridLinearMax[] = {512, 768, 1024};
+const int gridLinearShift[] = {1, 2};
+
+#define COUNT(array) (sizeof(array) / sizeof(array[0]))
+
+//all combinations of grid values
+void candidatesGrid()
+{
+	unsigned int a, b, c, d, e, f;
+
+	for (a = 0; a < COUNT(gridKp); a++)
+	for (b = 0; b < COUNT(gridKi); b++)
+	for (c = 0; c < COUNT(gridKii); c++)
+	for (d = 0; d < COUNT(gridKiiShift); d++)
+	for (e = 0; e < COUNT(gridLinearMax); e++)
+	for (f = 0; f < COUNT(gridLinearShift); f++)
+	{
+		struct candidate *candidate = &candidates[candidateCount++];
+
+		candidate->kp = gridKp[a];
+		candidate->ki = gridKi[b];
+		candidate->kii = gridKii[c];
+		candidate->kiiShift = gridKiiShift[d];
+		candidate->linearMax = gridLinearMax[e];
+		candidate->linearShift = gridLinearShift[f];
+	}
+}
+
+//random candidates in valid ranges of regulator.h
+void candidatesRandom(long count, unsigned int seed)
+{
+	srand(seed);
+	for (candidateCount = 0; candidateCount < count; candidateCount++)
+	{
+		struct candidate *candidate = &candidates[candidateCount];
+
+		candidate->kp = rand() % 64;
+		candidate->ki = rand() % 32;
+		candidate->kii = rand() % 32;
+		candidate->kiiShift = 3 + rand() % 5;
+		candidate->linearMax = 512 + 32 * (rand() % 17);
+		candidate->linearShift = 1 + rand() % 2;
+	}
+}
+
+/*----------------------------------
+Simulation
+-----------------------------------*/
+
+//one frame of firmware and model, return actual current 0-255
+unsigned char simulateFrame(unsigned char wantedCurrent)
+{
+	unsigned char actualCurrent = convertCurrent(sensorCurrent(modelCurrent));
+
+	modelFrame(regulator(wantedCurrent, actualCurrent), frameTime);
+	return actualCurrent;
+}
+
+//step response of motor current (regulated value - battery current is linearized by regulator)
+//at fixed wheel speed, overshoot % and settling time s to 5% band of final value (mean of last second)
+void simulateStep(double throttle, double speed, double *overshoot, double *settling)
+{
+	unsigned char wanted = convertAcceleration(sensorThrottle(throttle));
+	long frames = (long)(STEP_TIME / frameTime);
+	long finalFrames = (long)(1.0 / frameTime);
+	double current[frames];
+	unsigned int output[frames];
+	double peak = 0.0;
+	double final = 0.0;
+	long frame;
+
+	modelSpeedFixed = speed;
+	modelReset(riderMass);
+	simulateFrame(0);//current offset
+
+	for (frame = 0; frame < frames; frame++)
+	{
+		simulateFrame(wanted);
+		current[frame] = modelMotorCurrent;
+		output[frame] = regOutput;
+		if (current[frame] > peak) peak = current[frame];
+		if (frame >= frames - finalFrames) final += current[frame] / finalFrames;
+	}
+
+	*settling = 0.0;
+	for (frame = frames - 1; frame >= 0; frame--)
+	{
+		//out of band and not limited by saturated output
+		if (fabs(current[frame] - final) > 0.05 * final && output[frame] < REG_OUTPUT_MAX)
+		{
+			*settling = (frame + 1) * frameTime;
+			break;
+		}
+	}
+	*overshoot = final > 0.0 ? (peak - final) * 100.0 / final : 0.0;
+	modelSpeedFixed = -1.0;
+}
+
+//evaluates candidate
+void simulateCandidate(long index, struct result *result)
+{
+	const double steps[] = {0.3, 0.6, 1.0};
+	const double speeds[] = {0.0, 4.0};		//m/s
+	struct candidate *candidate = &candidates[index];
+	long frames = (long)(RIDE_TIME / frameTime);
+	long frame;
+	unsigned int i;
+	unsigned int j;
+
+	regKp = candidate->kp;
+	regKi = candidate->ki;
+	regKii = candidate->kii;
+	regKiiShift = candidate->kiiShift;
+	regLinearMax = candidate->linearMax;
+	regLinearShift = candidate->linearShift;
+
+	result->index = index;
+	result->overshoot = 0.0;
+	result->settling = 0.0;
+	for (i = 0; i < COUNT(steps); i++)
+	for (j = 0; j < COUNT(speeds); j++)
+	{
+		double overshoot;
+		double settling;
+
+		simulateStep(steps[i], speeds[j], &overshoot, &settling);
+		if (overshoot > result->overshoot) result->overshoot = overshoot;
+		if (settling > result->settling) result->settling = settling;
+	}
+
+	modelReset(riderMass);
+	simulateFrame(0);
+	for (frame = 0; frame < frames; frame++)
+	{
+		double time = frame * frameTime;
+		double throttle = time < 40.0 ? 1.0 : (time < 80.0 ? 0.5 : 0.0);
+
+		simulateFrame(convertAcceleration(sensorThrottle(throttle)));
+	}
+	result->energy = modelDistance > 0.0 ? modelEnergy / (modelDistance / 1000.0) : 1e9;
+}
+
+double cost(const struct result *result)
+{
+	return weightOvershoot * result->overshoot + weightSettling * result->settling + weightEnergy * result->energy;
+}
+
+int resultCompare(const void *a, const void *b)
+{
+	double costA = cost((const struct result *)a);
+	double costB = cost((const struct result *)b);
+
+	return (costA > costB) - (costA < costB);
+}
+
+/*----------------------------------
+Main
+-----------------------------------*/
+
+//writes header with best candidate, return 0 if OK
+int headerWrite(const char *fileName, const struct result *result)
+{
+	const struct candidate *candidate = &candidates[result->index];
+	FILE *file = fopen(fileName, "w");
+
+	if (file == NULL) return 1;
+
+	fprintf(file, "/*\n * regulator_gains.h\n *\n * Generated by sim/gain_tuner, %.0f frames/s, rider %.0f kg.\n", 1.0 / frameTime, riderMass);
+	fprintf(file, " * Overshoot %.1f %%, settling %.2f s, energy %.2f Wh/km.\n */\n\n", result->overshoot, result->settling, result->energy);
+	fprintf(file, "#ifndef REGULATOR_GAINS_H\n#define REGULATOR_GAINS_H\n\n");
+	fprintf(file, "#define REG_KP %d\n", candidate->kp);
+	fprintf(file, "#define REG_KI %d\n", candidate->ki);
+	fprintf(file, "#define REG_KII %d\n", candidate->kii);
+	fprintf(file, "#define REG_KII_SHIFT %d\n", candidate->kiiShift);
+	fprintf(file, "#define REG_LINEAR_MAX %d\n", candidate->linearMax);
+	fprintf(file, "#define REG_LINEAR_SHIFT %d\n", candidate->linearShift);
+	fprintf(file, "\n#endif\n");
+	fclose(file);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	long randomCount = 0;
+	unsigned int seed = 1;
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	const char *headerName = NULL;
+	int pipes[JOBS_MAX];
+	pid_t pids[JOBS_MAX];
+	long received = 0;
+	int failed = 0;
+	int option;
+	long i;
+	long job;
+
+	while ((option = getopt(argc, argv, "n:s:j:r:m:w:o:")) != -1)
+	{
+		switch (option)
+		{
+			case 'n': randomCount = atol(optarg); break;
+			case 's': seed = atoi(optarg); break;
+			case 'j': jobs = atol(optarg); break;
+			case 'r': frameTime = 1.0 / atof(optarg); break;
+			case 'm': riderMass = atof(optarg); break;
+			case 'w': sscanf(optarg, "%lf,%lf,%lf", &weightOvershoot, &weightSettling, &weightEnergy); break;
+			case 'o': headerName = optarg; break;
+			default:
+				fprintf(stderr, "usage: %s [-n random_count] [-s seed] [-j jobs] [-r frames_per_s] [-m rider_kg] [-w overshoot,settling,energy] [-o header]\n", argv[0]);
+				return 1;
+		}
+	}
+	if (jobs < 1) jobs = 1;
+	if (jobs > JOBS_MAX) jobs = JOBS_MAX;
+	if (randomCount > CANDIDATES_MAX || !(frameTime > 0.0))
+	{
+		fprintf(stderr, "random_count must be <= %d and frames_per_s > 0\n", CANDIDATES_MAX);
+		return 1;
+	}
+	regFrames = (int)(0.02 / frameTime + 0.5);
+	if (regFrames < 1) regFrames = 1;
+
+	if (randomCount > 0) candidatesRandom(randomCount, seed);
+	else candidatesGrid();
+	fprintf(stderr, "%ld candidates, %ld jobs\n", candidateCount, jobs);
+
+	//workers - every job takes every jobs-th candidate, results through pipe
+	for (job = 0; job < jobs; job++)
+	{
+		int fd[2];
+
+		if (pipe(fd) != 0)
+		{
+			perror("pipe");
+			return 1;
+		}
+		switch (pids[job] = fork())
+		{
+			case -1:
+				perror("fork");
+				return 1;
+			case 0:
+				close(fd[0]);
+				for (i = job; i < candidateCount; i += jobs)
+				{
+					struct result result;
+
+					simulateCandidate(i, &result);
+					if (write(fd[1], &result, sizeof(result)) != sizeof(result)) _exit(1);
+				}
+				_exit(0);
+		}
+		close(fd[1]);
+		pipes[job] = fd[0];
+	}
+
+	for (job = 0; job < jobs; job++)
+	{
+		struct result result;
+
+		while (read(pipes[job], &result, sizeof(result)) == sizeof(result))
+		{
+			if (result.index < job || result.index >= candidateCount || (result.index - job) % jobs != 0) continue;
+			results[result.index] = result;
+			received++;
+		}
+		close(pipes[job]);
+	}
+	for (job = 0; job < jobs; job++)
+	{
+		int status;
+
+		if (waitpid(pids[job], &status, 0) != pids[job] || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		{
+			fprintf(stderr, "job %ld failed\n", job);
+			failed = 1;
+		}
+	}
+	if (failed || received != candidateCount)
+	{
+		fprintf(stderr, "%ld of %ld candidates evaluated\n", received, candidateCount);
+		return 1;
+	}
+
+	qsort(results, candidateCount, sizeof(results[0]), resultCompare);
+
+	printf("rank,cost,overshoot_pct,settling_s,energy_Whkm,kp,ki,kii,kiiShift,linearMax,linearShift\n");
+	for (i = 0; i < candidateCount; i++)
+	{
+		const struct candidate *candidate = &candidates[results[i].index];
+
+		printf("%ld,%.3f,%.2f,%.3f,%.3f,%d,%d,%d,%d,%d,%d\n", i + 1, cost(&results[i]), results[i].overshoot,
+			results[i].settling, results[i].energy, candidate->kp, candidate->ki, candidate->kii,
+			candidate->kiiShift, candidate->linearMax, candidate->linearShift);
+	}
+
+	if (headerName != NULL && headerWrite(headerName, &results[0]))
+	{
+		fprintf(stderr, "cannot write %s\n", headerName);
+		return 1;
+	}
+
+	return 0;
+}
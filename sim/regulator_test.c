@@ -0,0 +1,295 @@
+/*
+ * regulator_test.c
+ *
+ * Host test bench of regulator.h. The regulator is run in closed loop with
+ * a plant at fixed speed (motor current follows the ESC output with first
+ * order lag, battery current = motor current scaled back by the regulator
+ * linearization), so the step response settles. Every test prints PASS or
+ * FAIL, exit code is number of failed tests.
+ *
+ * Build:	gcc -std=gnu99 -O2 -Wall -I../ESC_prog -o regulator_test regulator_test.c -lm
+ * Run:		./regulator_test
+ *
+ * Cycle count of regulator() is not measurable on host - the worst case path
+ * (active, not saturated, both integrators updated) is driven by the
+ * "fuzz" test, on AVR it is part of TIMER1_COMPB_vect max. of ISR_STATS.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+//gains of regulator.h as variables
+int regKp;
+int regKi;
+int regKii;
+int regKiiShift;
+int regLinearMax;
+int regLinearShift;
+
+#define REG_KP regKp
+#define REG_KI regKi
+#define REG_KII regKii
+#define REG_KII_SHIFT regKiiShift
+#define REG_LINEAR_MAX regLinearMax
+#define REG_LINEAR_SHIFT regLinearShift
+
+int regFrames = 1;				//regulator calls per 20ms (FRAMES_PER_20MS)
+
+#define REG_FRAMES regFrames
+
+#include "regulator.h"
+
+/*----------------------------------
+Plant
+-----------------------------------*/
+
+#define PLANT_OFFSET 3			//measured current with motor off (0-255)
+#define PLANT_LAG 0.33			//ESC + motor response per 20ms (tau 50ms)
+
+double plantMotor;				//motor current 0-255
+double plantLimit;				//max motor current (power limit of ESC / battery)
+double plantLag = PLANT_LAG;	//response per frame
+
+void plantReset(double limit)
+{
+	plantMotor = 0.0;
+	plantLimit = limit;
+	plantLag = 1.0 - pow(1.0 - PLANT_LAG, 1.0 / regFrames);
+}
+
+//one frame, return measured battery current 0-255
+unsigned char plantFrame(unsigned int output)
+{
+	double target = output / 4.0;	//motor current at fixed speed, 1023 -> 255
+	double factor = (regLinearMax - (double)(output >> regLinearShift)) / 256.0;
+	double actual;
+
+	if (target > plantLimit) target = plantLimit;
+	plantMotor += (target - plantMotor) * plantLag;
+
+	actual = PLANT_OFFSET + plantMotor / factor;//regulator divides it back
+	if (actual > 255.0) actual = 255.0;
+	return (unsigned char)(actual + 0.5);
+}
+
+/*----------------------------------
+Tests
+-----------------------------------*/
+
+int failures = 0;
+
+void gainsDefault()
+{
+	regKp = 0;
+	regKi = 1;
+	regKii = 1;
+	regKiiShift = 6;
+	regLinearMax = 768;
+	regLinearShift = 1;
+}
+
+void check(int condition, const char *name, const char *detail)
+{
+	printf("%s %s%s%s\n", condition ? "PASS" : "FAIL", name, condition ? "" : ": ", condition ? "" : detail);
+	if (!condition) failures++;
+}
+
+//step from rest, return 20ms ticks to enter and stay in +-band of wanted (-1 = never), overshoot of motor current,
+//frames - length in 20ms ticks (regFrames regulator calls per tick)
+int stepResponse(unsigned char wanted, int frames, double band, double *overshoot)
+{
+	unsigned char actual;
+	double peak = 0.0;
+	int settled = -1;
+	int frame;
+
+	plantReset(255.0);
+	regulatorReset(PLANT_OFFSET);
+	actual = plantFrame(0);
+
+	for (frame = 0; frame < frames * regFrames; frame++)
+	{
+		actual = plantFrame(regulator(wanted, actual));
+		if (plantMotor > peak) peak = plantMotor;
+		if (fabs(plantMotor - wanted) > band) settled = -1;
+		else if (settled < 0) settled = frame / regFrames;
+	}
+	*overshoot = (peak - wanted) * 100.0 / wanted;
+	return settled;
+}
+
+void testStep()
+{
+	const unsigned char steps[] = {30, 100, 200};
+	char detail[128];
+	unsigned int i;
+
+	gainsDefault();
+	for (i = 0; i < sizeof(steps); i++)
+	{
+		double overshoot;
+		int settled = stepResponse(steps[i], 750, 0.05 * steps[i] + 1.0, &overshoot);
+
+		snprintf(detail, sizeof(detail), "wanted %u settled at frame %d, overshoot %.1f %%", steps[i], settled, overshoot);
+		check(settled >= 0 && settled < 500, "step settles to 5% in 10s", detail);
+		check(overshoot < 40.0, "step overshoot < 40%", detail);
+	}
+}
+
+//faster ESC_PROTOCOLs (regulator every 2.5ms / 0.5ms) - same response in time as at 50Hz
+void testFrameRate()
+{
+	const int frameRates[] = {8, 40};		//FRAMES_PER_20MS of ESC_PWM400, ESC_ONESHOT125
+	char detail[128];
+	unsigned int i;
+
+	gainsDefault();
+	for (i = 0; i < sizeof(frameRates) / sizeof(frameRates[0]); i++)
+	{
+		double overshoot50;
+		double overshoot;
+		int settled50;
+		int settled;
+
+		regFrames = 1;
+		settled50 = stepResponse(100, 750, 6.0, &overshoot50);
+		regFrames = frameRates[i];
+		settled = stepResponse(100, 750, 6.0, &overshoot);
+		regFrames = 1;
+
+		snprintf(detail, sizeof(detail), "%d frames/20ms settled at %d (50Hz %d), overshoot %.1f %% (50Hz %.1f %%)",
+			frameRates[i], settled, settled50, overshoot, overshoot50);
+		check(settled >= 0 && abs(settled - settled50) <= settled50 / 5 + 1, "faster protocol settles as 50Hz", detail);
+		check(overshoot < overshoot50 + 5.0, "faster protocol overshoot as 50Hz", detail);
+	}
+}
+
+//first active frame must not jump by KP * e
+void testBumpless()
+{
+	char detail[128];
+	unsigned int output;
+
+	gainsDefault();
+	regKp = 16;
+	regulatorReset(PLANT_OFFSET);
+	output = regulator(100, PLANT_OFFSET);
+
+	snprintf(detail, sizeof(detail), "first output %u, KP * e = %d", output, (regKp * 100) >> REG_Q);
+	check(output <= (unsigned int)((regKi * 100 + regKii * 100) >> REG_Q) + 1, "bumpless start", detail);
+}
+
+//frames to motor current <= 55 after wanted 255 (not reachable, limit 100) for hold frames and then 50
+int windupRecovery(int hold)
+{
+	unsigned char actual;
+	int frame;
+
+	plantReset(100.0);
+	regulatorReset(PLANT_OFFSET);
+	actual = plantFrame(0);
+	for (frame = 0; frame < hold; frame++) actual = plantFrame(regulator(255, actual));
+
+	plantLimit = 255.0;
+	for (frame = 0; frame < 1000 && plantMotor > 55.0; frame++) actual = plantFrame(regulator(50, actual));
+	return frame;
+}
+
+//long saturation must not delay reaction to lower wanted current
+void testWindup()
+{
+	char detail[128];
+	int recoveryShort;
+	int recoveryLong;
+
+	gainsDefault();
+	recoveryShort = windupRecovery(100);
+	recoveryLong = windupRecovery(3000);
+
+	snprintf(detail, sizeof(detail), "recovery after 2s saturation %d frames, after 60s %d frames", recoveryShort, recoveryLong);
+	check(recoveryLong < 1000 && recoveryLong <= recoveryShort + 5, "anti-windup", detail);
+}
+
+//measured current under offset (signed error), output must rise and stay in range
+void testUnderOffset()
+{
+	char detail[128];
+	unsigned int output = 0;
+	int frame;
+
+	gainsDefault();
+	regulatorReset(20);
+	for (frame = 0; frame < 100; frame++) output = regulator(50, 0);
+
+	snprintf(detail, sizeof(detail), "output %u", output);
+	check(output > 0 && output <= REG_OUTPUT_MAX, "current under offset", detail);
+}
+
+void testOff()
+{
+	unsigned char actual;
+	int frame;
+
+	gainsDefault();
+	plantReset(255.0);
+	regulatorReset(PLANT_OFFSET);
+	actual = plantFrame(0);
+	for (frame = 0; frame < 100; frame++) actual = plantFrame(regulator(200, actual));
+
+	check(regulator(1, actual) == 0 && regActive == 0, "wanted <= 1 switches off", "output is not 0");
+}
+
+//random inputs with random gains, output and integrators within their saturation limits
+void testFuzz()
+{
+	char detail[128];
+	int ok = 1;
+	long run;
+	long frame;
+
+	srand(1);
+	for (run = 0; run < 1000 && ok; run++)
+	{
+		regKp = rand() % 128;
+		regKi = rand() % 128;
+		regKii = rand() % 128;
+		regKiiShift = 3 + rand() % 5;//3-7, REG_ERROR_SUM_MAX fits to 16b
+		regLinearMax = 512 + rand() % 513;
+		regLinearShift = 1 + rand() % 2;
+		regFrames = run % 3 == 0 ? 1 : (run % 3 == 1 ? 8 : 40);
+		regulatorReset(rand() % 64);
+
+		for (frame = 0; frame < 2000 && ok; frame++)
+		{
+			unsigned int output = regulator(rand() % 256, rand() % 256);
+
+			if (output > REG_OUTPUT_MAX || output != regOutput
+				|| regIntegral < -REG_INTEGRAL_MAX || regIntegral > REG_INTEGRAL_MAX
+				|| regErrorSum < -REG_ERROR_SUM_MAX || regErrorSum > REG_ERROR_SUM_MAX
+				|| regErrorResidual < 0 || regErrorResidual >= 1L << REG_STEP_SHIFT
+				|| regIntegralResidual < 0 || regIntegralResidual >= 1L << REG_STEP_SHIFT)
+			{
+				snprintf(detail, sizeof(detail), "run %ld frame %ld: output %u, I %d, E %d", run, frame,
+					output, regIntegral, regErrorSum);
+				ok = 0;
+			}
+		}
+	}
+	regFrames = 1;
+	check(ok, "output and state in range", detail);
+}
+
+int main()
+{
+	testStep();
+	testFrameRate();
+	testBumpless();
+	testWindup();
+	testUnderOffset();
+	testOff();
+	testFuzz();
+
+	printf("%d failed\n", failures);
+	return failures;
+}
@@ -0,0 +1,147 @@
+#ifndef SCOOTER_MODEL_H
+#define SCOOTER_MODEL_H
+
+#include <math.h>
+
+/**
+ * Physical model of the scooter - DC motor, ESC, battery with internal
+ * resistance, scooter with rider - and its sensors in firmware ADC scale.
+ * Used by scooter_sim.c and gain_tuner.c.
+ */
+
+/**
+ * Model parameters.
+ */
+//motor (brushless with ESC as DC motor), belt drive
+#define MOTOR_KE 0.0503			//back EMF constant V/(rad/s), = torque constant Nm/A (190 rpm/V)
+#define MOTOR_R 0.10			//winding + ESC resistance ohm
+#define GEAR_RATIO 2.5			//motor / wheel
+#define WHEEL_CIRCUMFERENCE 0.377	//m, same as firmware
+
+//ESC
+#define ESC_TAU 0.05			//response of duty to servo impulse s
+#define ESC_IDLE_CURRENT 0.2	//A
+
+//battery 4S LiPo
+#define BATTERY_CAPACITY 10.0	//Ah
+#define BATTERY_FULL 16.8		//V
+#define BATTERY_EMPTY 13.2		//V
+#define BATTERY_R 0.05			//internal resistance ohm
+
+//scooter
+#define SCOOTER_MASS 8.0		//kg
+#define ROLLING_RESISTANCE 0.015
+#define DRAG_AREA 0.6			//Cd * A m2
+#define AIR_DENSITY 1.2			//kg/m3
+#define GRAVITY 9.81
+
+#define PHYSICS_STEP 0.001		//s, shorter is used if frame is shorter
+
+/**
+ * Model state.
+ */
+double modelMass;				//scooter + rider kg
+double modelDuty;				//ESC output 0-1
+double modelSpeed;				//m/s
+double modelDistance;			//m
+double modelCharge;				//consumed Ah
+double modelEnergy;				//consumed Wh
+double modelCurrent;			//battery current averaged over last frame A
+double modelMotorCurrent;		//motor current averaged over last frame A
+double modelVoltage;			//battery voltage V
+double modelSpeedFixed = -1.0;	//m/s, >= 0 holds speed (test stand), < 0 = free ride
+
+/**
+ * Sets model to rest with full battery.
+ * @param riderMass mass of rider kg
+ */
+void modelReset(double riderMass)
+{
+	modelMass = SCOOTER_MASS + riderMass;
+	modelDuty = 0.0;
+	modelSpeed = 0.0;
+	modelDistance = 0.0;
+	modelCharge = 0.0;
+	modelEnergy = 0.0;
+	modelCurrent = 0.0;
+	modelMotorCurrent = 0.0;
+	modelVoltage = BATTERY_FULL;
+	if (modelSpeedFixed >= 0.0) modelSpeed = modelSpeedFixed;
+}
+
+/**
+ * Simulates one frame of ESC output.
+ * @param wantedSpeed servo impulse 0-1023
+ * @param frameTime length of frame s
+ */
+void modelFrame(unsigned int wantedSpeed, double frameTime)
+{
+	int steps = (int)ceil(frameTime / PHYSICS_STEP);
+	double step = frameTime / steps;
+	int i;
+
+	modelCurrent = 0.0;
+	modelMotorCurrent = 0.0;
+	for (i = 0; i < steps; i++)
+	{
+		double wheelSpeed = modelSpeed / WHEEL_CIRCUMFERENCE * 2.0 * M_PI;	//rad/s
+		double backEmf = MOTOR_KE * wheelSpeed * GEAR_RATIO;
+		double openVoltage = BATTERY_FULL - (BATTERY_FULL - BATTERY_EMPTY) * modelCharge / BATTERY_CAPACITY;
+		double motorCurrent;
+		double batteryCurrent;
+		double force;
+
+		modelDuty += (wantedSpeed / 1023.0 - modelDuty) * step / ESC_TAU;
+
+		//battery voltage from last step current (sag)
+		motorCurrent = (modelDuty * modelVoltage - backEmf) / MOTOR_R;
+		if (motorCurrent < 0.0) motorCurrent = 0.0;//no regenerative braking, freewheel
+		batteryCurrent = modelDuty * motorCurrent + ESC_IDLE_CURRENT;
+		modelVoltage = openVoltage - BATTERY_R * batteryCurrent;
+
+		force = motorCurrent * MOTOR_KE * GEAR_RATIO * 2.0 * M_PI / WHEEL_CIRCUMFERENCE;
+		if (modelSpeed > 0.0)
+		{
+			force -= ROLLING_RESISTANCE * modelMass * GRAVITY + 0.5 * AIR_DENSITY * DRAG_AREA * modelSpeed * modelSpeed;
+		}
+		if (modelSpeedFixed < 0.0)
+		{
+			modelSpeed += force / modelMass * step;
+			if (modelSpeed < 0.0) modelSpeed = 0.0;
+		}
+
+		modelDistance += modelSpeed * step;
+		modelCharge += batteryCurrent * step / 3600.0;
+		modelEnergy += batteryCurrent * modelVoltage * step / 3600.0;
+		modelCurrent += batteryCurrent / steps;
+		modelMotorCurrent += motorCurrent / steps;
+	}
+}
+
+/**
+ * Acceleration handle 0.86V - 4.5V.
+ * @param throttle 0-1
+ * @return 8b ADC result (255 = 4.7V)
+ */
+unsigned char sensorThrottle(double throttle)
+{
+	double volts = 0.86 + throttle * (4.5 - 0.86);
+
+	return (unsigned char)(volts / 4.7 * 255.0 + 0.5);
+}
+
+/**
+ * Current sensor 0.6V + 0.04V/A.
+ * @param current A
+ * @return 12b oversampled value (16 = 1 step of 8b ADC)
+ */
+unsigned int sensorCurrent(double current)
+{
+	double sample = (0.6 + current * 0.04) / 4.7 * 255.0 * 16.0;
+
+	if (sample < 0.0) sample = 0.0;
+	if (sample > 4095.0) sample = 4095.0;
+	return (unsigned int)(sample + 0.5);
+}
+
+#endif
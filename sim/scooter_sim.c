@@ -0,0 +1,178 @@
+/*
+ * scooter_sim.c
+ *
+ * Closed loop simulator of the scooter for the host (Linux).
+ * Firmware control code (regulator.h, conversion.h) is compiled against
+ * a physical model (scooter_model.h). Output is CSV time series on stdout.
+ *
+ * Build:	gcc -std=gnu99 -O2 -I../ESC_prog -o scooter_sim scooter_sim.c -lm
+ * Run:		./scooter_sim [-t seconds] [-m rider_kg] [-r frames_per_s] [-d decimation] [-p profile.csv]
+ *
+ * profile.csv - lines "time_s,throttle" (throttle 0-1), time ascending,
+ * linear interpolation, last value is held. Without profile a 180s cycle
+ * is repeated: 5s idle, full throttle to 60s, half to 120s, off to 180s.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+
+int regFrames = 1;				//FRAMES_PER_20MS of firmware, regulator runs every frame
+
+#define REG_FRAMES regFrames
+
+#include "conversion.h"
+#include "regulator.h"
+#include "scooter_model.h"
+
+/*----------------------------------
+Throttle profile
+-----------------------------------*/
+
+#define PROFILE_MAX 4096
+
+double profileTime[PROFILE_MAX];
+double profileThrottle[PROFILE_MAX];
+int profileLength = 0;
+
+//reads profile from CSV, return 0 if OK
+int profileRead(const char *fileName)
+{
+	FILE *file = fopen(fileName, "r");
+	char line[128];
+
+	if (file == NULL) return 1;
+
+	while (fgets(line, sizeof(line), file) != NULL && profileLength < PROFILE_MAX)
+	{
+		if (sscanf(line, "%lf,%lf", &profileTime[profileLength], &profileThrottle[profileLength]) == 2)
+		{
+			profileLength++;
+		}
+	}
+	fclose(file);
+
+	return profileLength == 0;
+}
+
+//throttle 0-1 in time
+double profileThrottleAt(double time)
+{
+	int i;
+
+	if (profileLength == 0)//default profile
+	{
+		time = fmod(time, 180.0);
+		if (time < 5.0) return 0.0;
+		if (time < 60.0) return 1.0;
+		if (time < 120.0) return 0.5;
+		return 0.0;
+	}
+
+	if (time <= profileTime[0]) return profileThrottle[0];
+	for (i = 1; i < profileLength; i++)
+	{
+		if (time < profileTime[i])
+		{
+			return profileThrottle[i - 1] + (profileThrottle[i] - profileThrottle[i - 1])
+				* (time - profileTime[i - 1]) / (profileTime[i] - profileTime[i - 1]);
+		}
+	}
+	return profileThrottle[profileLength - 1];
+}
+
+/*----------------------------------
+Main
+-----------------------------------*/
+
+int main(int argc, char *argv[])
+{
+	double duration = 3600.0;
+	double riderMass = 80.0;
+	double frameRate = 50.0;
+	long decimation = 1;
+	int option;
+
+	//firmware state
+	unsigned int wantedSpeed = 0;
+	unsigned char wantedCurrent = 0;
+	unsigned char actualCurrent = 0;
+	unsigned int consumedCapacityFraction = 0;
+	unsigned long consumedCapacity = 0;
+	unsigned int capacitySampleSum = 0;	//current of every frame in actual 20ms (conversions in firmware)
+	unsigned char capacitySampleCount = 0;
+
+	double frameTime;
+	long frames;
+	long frame;
+	double time;
+
+	while ((option = getopt(argc, argv, "t:m:r:d:p:")) != -1)
+	{
+		switch (option)
+		{
+			case 't': duration = atof(optarg); break;
+			case 'm': riderMass = atof(optarg); break;
+			case 'r': frameRate = atof(optarg); break;
+			case 'd': decimation = atol(optarg); break;
+			case 'p':
+				if (profileRead(optarg))
+				{
+					fprintf(stderr, "cannot read profile %s\n", optarg);
+					return 1;
+				}
+			break;
+			default:
+				fprintf(stderr, "usage: %s [-t seconds] [-m rider_kg] [-r frames_per_s] [-d decimation] [-p profile.csv]\n", argv[0]);
+				return 1;
+		}
+	}
+	if (frameRate <= 0.0 || decimation < 1) return 1;
+
+	frameTime = 1.0 / frameRate;
+	frames = (long)(duration * frameRate);
+	modelReset(riderMass);
+	regFrames = (int)(0.02 * frameRate + 0.5);
+	if (regFrames < 1) regFrames = 1;
+
+	printf("time_s,throttle,wantedCurrent,actualCurrent,current_A,wantedSpeed,duty,speed_kmh,voltage_V,consumedCapacity_mAh\n");
+
+	for (frame = 0; frame < frames; frame++)
+	{
+		double throttle;
+
+		time = frame * frameTime;
+		throttle = profileThrottleAt(time);
+
+		//firmware - compare B interrupt
+		actualCurrent = convertCurrent(sensorCurrent(modelCurrent));
+		wantedCurrent = convertAcceleration(sensorThrottle(throttle));
+		wantedSpeed = regulator(wantedCurrent, actualCurrent);
+
+		//every 20ms average + 1, CAPACITY_UNIT = 922 of firmware
+		capacitySampleSum += actualCurrent;
+		capacitySampleCount++;
+		if (frame % regFrames == 0)
+		{
+			consumedCapacityFraction += (capacitySampleSum + (capacitySampleCount >> 1)) / capacitySampleCount + 1;
+			capacitySampleSum = 0;
+			capacitySampleCount = 0;
+		}
+		if (consumedCapacityFraction >= 922)
+		{
+			consumedCapacityFraction -= 922;
+			consumedCapacity++;
+		}
+
+		modelFrame(wantedSpeed, frameTime);
+
+		if (frame % decimation == 0)
+		{
+			printf("%.3f,%.3f,%u,%u,%.2f,%u,%.3f,%.2f,%.2f,%lu\n", time, throttle, wantedCurrent, actualCurrent,
+				modelCurrent, wantedSpeed, modelDuty, modelSpeed * 3.6, modelVoltage, consumedCapacity);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+#
+# variant_size.sh
+#
+# Builds ESC_prog.c for every ESC_VARIANT with avr-gcc (options of
+# ESC_prog.cproj, release) and prints flash / RAM use and code size of the
+# interrupt routines side by side. Needs avr-gcc, avr-size and avr-nm in PATH.
+#
+# Run:		./variant_size.sh [extra avr-gcc options, e.g. -DESC_PROTOCOL=1]
+#
+# ISR columns are bytes of code (avr-nm), not cycles - TIMER1_COMPB_vect
+# holds the regulator. Cycle counts are out of scope of this report, on the
+# device they are shown by ISR_STATS=1.
+#
+
+SOURCE=$(dirname "$0")/../ESC_prog/ESC_prog.c
+OUT=${TMPDIR:-/tmp}/esc_variant
+CFLAGS="-mmcu=atmega8 -Os -funsigned-char -funsigned-bitfields -fpack-struct -fshort-enums -Wall -std=gnu99"
+
+#code size of vector in bytes, - if not present
+isr()
+{
+	size=$(avr-nm -S $OUT$variant.elf | awk -v name=$1 '$4 == name { print $2 }')
+	if [ -n "$size" ]; then printf "%d" 0x$size; else printf "-"; fi
+}
+
+printf "%-8s %6s %6s %6s %6s %6s %6s %6s\n" variant text data bss COMPB FRAME ADC INT0
+for variant in 0 1 2 3
+do
+	avr-gcc $CFLAGS -DESC_VARIANT=$variant "$@" -o $OUT$variant.elf "$SOURCE" || exit 1
+
+	#ATmega8: __vector_7 TIMER1_COMPB, __vector_6 TIMER1_COMPA (__vector_8 TIMER1_OVF with SERVO_HW_PWM),
+	#__vector_14 ADC, __vector_1 INT0
+	frame=__vector_6
+	case "$*" in *SERVO_HW_PWM=1*) frame=__vector_8;; esac
+
+	printf "%-8s %6s %6s %6s %6s %6s %6s %6s\n" $variant \
+		$(avr-size $OUT$variant.elf | awk 'END { print $1, $2, $3 }') \
+		$(isr __vector_7) $(isr $frame) $(isr __vector_14) $(isr __vector_1)
+done